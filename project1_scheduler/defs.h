@@ -1,6 +1,7 @@
 struct buf;
 struct context;
 struct file;
+struct kcache;
 struct inode;
 struct pipe;
 struct proc;
@@ -10,6 +11,9 @@ struct sleeplock;
 struct stat;
 struct superblock;
 struct queue;
+struct runqueue;
+struct schedparams;
+struct schedstats;
 
 // bio.c
 void            binit(void);
@@ -25,6 +29,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             loadimage(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -66,6 +71,11 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+void            kref(char*);
+int             krefs(char*);
+char*           kalloc_order(int);
+void            kfree_order(char*, int);
+void            kallocdump(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
@@ -80,6 +90,8 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(uchar, int);
+extern uint     tscperms;
 void            microdelay(int);
 
 // log.c
@@ -97,16 +109,23 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
+// slab.c
+void            kcacheinit(struct kcache*, char*, uint);
+void*           kcachealloc(struct kcache*);
+void            kcachefree(struct kcache*, void*);
+
 //PAGEBREAK: 16
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             spawn(char*, char**, int*);
 int             growproc(int);
 int             kill(int);
 struct cpu*     mycpu(void);
@@ -120,7 +139,7 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
-void            yield(void);
+void            yield(int);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -177,6 +196,7 @@ void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
+void            allocbiguvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
@@ -186,6 +206,9 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             demanduvm(pde_t*, uint);
+int             faultuvm(pde_t*, uint);
+int             touchuvm(pde_t*, uint, uint);
 
 
 // prac_syscall.c
@@ -195,16 +218,23 @@ int             myfunction(char*);
 // proc.c
 int             getTimeQuantum(int); 
 struct proc*    getProc(int);
-void            clearProc(struct proc*);
+void            makeRunnable(struct proc*);
+void            schedulerTick(void);
+void            rtTick(void);
 void            boostPriority();
 int             getLevel(void);
 void            setPriority(int, int);
 void            schedulerLock();
 void            schedulerUnlock();
-struct proc*    getProcessToRun();
+struct proc*    getProcessToRun(struct cpu*);
 void            expireTimeQuantum(struct proc*);
 void            printqueues(void);
 void            setLevel(int, int);
+int             setschedparams(struct schedparams*);
+void            getschedparams(struct schedparams*);
+int             getschedstats(int, struct schedstats*);
+int             settickets(int, int);
+extern struct schedparams schedparams;
 
 // queue.c
 void printqueue(struct queue *);
@@ -213,6 +243,18 @@ void erasequeue(struct queue *, struct proc *);
 struct proc *popqueue(struct queue *);
 struct proc *frontqueue(struct queue *);
 void pushfrontqueue(struct queue*, struct proc*);
+void initrunqueue(struct runqueue *);
+void pushrunqueue(struct runqueue *, struct proc *);
+void eraserunqueue(struct runqueue *, struct proc *);
+struct proc *poprunqueue(struct runqueue *, int);
+void splicequeue(struct queue *, struct queue *);
+void boostrunqueue(struct runqueue *);
+void requeuerunqueue(struct runqueue *);
+struct proc *frontrunqueue(struct runqueue *, int);
+#ifdef DEBUG_QUEUES
+int checkqueue(struct queue *);
+int checkrunqueue(struct runqueue *);
+#endif
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and blocks of
+// 2^n physically contiguous pages with kalloc_order().
 
 #include "types.h"
 #include "defs.h"
@@ -15,12 +16,33 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;   // on the lists of kmem.free only
+};
+
+// Free memory is kept by a buddy allocator: a free block of order k
+// is 2^k pages starting at a page number that is a multiple of 2^k,
+// and is merged with its buddy, the other half of the block of order
+// k+1, as soon as both are free.
+//
+// Free pages kept by each cpu, so that most calls do not take
+// kmem.lock. A magazine that runs empty or full moves KBATCH
+// pages from or to the buddy lists at once.
+#define KMAG   32
+#define KBATCH (KMAG/2)
+
+struct magazine {
+  struct run *list;
+  int n;
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[KMAXORDER+1];  // free blocks of each order
+  uint nblock[KMAXORDER+1];       // length of each of those lists
+  struct magazine mag[NCPU];
+  uchar ref[PHYSTOP/PGSIZE];  // mappings of each page, for copy-on-write
+  uchar order[PHYSTOP/PGSIZE];  // 1 + order of a free block at each page
 } kmem;
 
 // Initialization happens in two phases.
@@ -36,6 +58,8 @@ kinit1(void *vstart, void *vend)
   freerange(vstart, vend);
 }
 
+// The magazines are only used once the other cpus run, with
+// kmem.use_lock set, as cpuid() needs mpinit().
 void
 kinit2(void *vstart, void *vend)
 {
@@ -48,32 +72,128 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p) / PGSIZE] = 1;
     kfree(p);
+  }
+}
+static void
+pushblock(struct run *r, int k)
+{
+  r->prev = 0;
+  r->next = kmem.free[k];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[k] = r;
+  kmem.nblock[k]++;
+  kmem.order[V2P(r) / PGSIZE] = k + 1;
+}
+
+static void
+eraseblock(struct run *r, int k)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nblock[k]--;
+  kmem.order[V2P(r) / PGSIZE] = 0;
+}
+
+// Take a free block of order k, splitting a larger one if there is
+// none. Caller holds kmem.lock, if use_lock.
+static struct run*
+buddyalloc(int k)
+{
+  struct run *r;
+  int j;
+
+  for(j = k; j <= KMAXORDER && kmem.free[j] == 0; j++)
+    ;
+  if(j > KMAXORDER)
+    return 0;
+  r = kmem.free[j];
+  eraseblock(r, j);
+  // the upper halves stay free
+  while(j > k){
+    j--;
+    pushblock((struct run*)((char*)r + (PGSIZE << j)), j);
+  }
+  return r;
+}
+
+// Free the block of order k at r, merged with its free buddies.
+// Caller holds kmem.lock, if use_lock.
+static void
+buddyfree(struct run *r, int k)
+{
+  uint pn, bn;
+
+  pn = V2P(r) / PGSIZE;
+  for(; k < KMAXORDER; k++){
+    bn = pn ^ (1 << k);
+    if(bn >= PHYSTOP/PGSIZE || kmem.order[bn] != k + 1)
+      break;
+    eraseblock((struct run*)P2V(bn * PGSIZE), k);
+    pn &= ~(1 << k);
+  }
+  pushblock((struct run*)P2V(pn * PGSIZE), k);
 }
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// A page shared copy-on-write is only freed by its last user.
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *s;
+  struct magazine *m;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  if(kmem.ref[V2P(v) / PGSIZE] == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(&kmem.ref[V2P(v) / PGSIZE], 1) != 0)
+    return;
 
+#ifdef DEBUG_KALLOC
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    buddyfree(r, 0);
+    return;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  if(m->n == KMAG){
+    // give back the oldest half, the newest pages are still cached
+    for(i = 0, s = m->list; i < KMAG-KBATCH-1; i++)
+      s = s->next;
+    r = s->next;
+    s->next = 0;
+    acquire(&kmem.lock);
+    for(; r; r = s){
+      s = r->next;
+      buddyfree(r, 0);
+    }
     release(&kmem.lock);
+    m->n -= KBATCH;
+    r = (struct run*)v;
+  }
+  r->next = m->list;
+  m->list = r;
+  m->n++;
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +203,111 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct magazine *m;
+
+  if(!kmem.use_lock){
+    r = buddyalloc(0);
+    if(r){
+      kmem.ref[V2P(r) / PGSIZE] = 1;
+    }
+    return (char*)r;
+  }
 
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  if(m->n == 0){
+    // Up to KBATCH pages; pages in the magazines of other cpus
+    // stay there, at most NCPU*KMAG of them.
+    acquire(&kmem.lock);
+    while(m->n < KBATCH && (r = buddyalloc(0)) != 0){
+      r->next = m->list;
+      m->list = r;
+      m->n++;
+    }
+    release(&kmem.lock);
+  }
+  r = m->list;
+  if(r){
+    m->list = r->next;
+    m->n--;
+    kmem.ref[V2P(r) / PGSIZE] = 1;
+  }
+  popcli();
+  return (char*)r;
+}
+
+// Count one more mapping of the allocated page v.
+void
+kref(char *v)
+{
+  __sync_add_and_fetch(&kmem.ref[V2P(v) / PGSIZE], 1);
+}
+
+// Number of mappings of the allocated page v.
+int
+krefs(char *v)
+{
+  return kmem.ref[V2P(v) / PGSIZE];
+}
+
+// Allocate a block of 2^n physically contiguous pages, aligned to
+// its size. Returns 0 if there is no free block that large; pages
+// kept by the cpus for kalloc() do not count.
+char*
+kalloc_order(int n)
+{
+  struct run *r;
+
+  if(n < 0 || n > KMAXORDER)
+    return 0;
+  if(n == 0)
+    return kalloc();
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  r = buddyalloc(n);
   if(kmem.use_lock)
     release(&kmem.lock);
+  if(r){
+    kmem.ref[V2P(r) / PGSIZE] = 1;
+  }
   return (char*)r;
 }
 
+// Free the block of 2^n pages at v from kalloc_order(n).
+void
+kfree_order(char *v, int n)
+{
+  if(n == 0){
+    kfree(v);
+    return;
+  }
+  if(n < 0 || n > KMAXORDER || V2P(v) % (PGSIZE << n) || v < end ||
+     V2P(v) + (PGSIZE << n) > PHYSTOP)
+    panic("kfree_order");
+  if(kmem.ref[V2P(v) / PGSIZE] != 1)
+    panic("kfree_order: not allocated");
+  kmem.ref[V2P(v) / PGSIZE] = 0;
+
+#ifdef DEBUG_KALLOC
+  memset(v, 1, PGSIZE << n);
+#endif
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  buddyfree((struct run*)v, n);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Print the free blocks of each order, to see how fragmented free
+// memory is: many small blocks cannot serve a large kalloc_order().
+void
+kallocdump(void)
+{
+  int k;
+
+  cprintf("free blocks by order:");
+  for(k = 0; k <= KMAXORDER; k++)
+    cprintf(" %d", kmem.nblock[k]);
+  cprintf("\n");
+}
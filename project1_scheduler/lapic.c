@@ -41,7 +41,14 @@
 #define TCCR    (0x0390/4)   // Timer Current Count
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
+#if 1000 % HZ != 0
+#error "HZ must divide 1000"
+#endif
+#define TIMERFREQ  1000000000  // Timer counts per second (bus clock of qemu)
+#define TIMERCOUNT (TIMERFREQ / HZ)   // Timer counts per tick
+
 volatile uint *lapic;  // Initialized in mp.c
+uint tscperms;         // Time stamp counter cycles per ms, 0 if unknown
 
 //PAGEBREAK!
 static void
@@ -51,6 +58,21 @@ lapicw(int index, int value)
   lapic[ID];  // wait for write to finish, by reading
 }
 
+// Measure how many time stamp counter cycles one ms takes,
+// by letting the timer count down one tick with its interrupt masked.
+static void
+calibratetsc(void)
+{
+  uint start;
+
+  lapicw(TIMER, MASKED);
+  lapicw(TICR, TIMERCOUNT);
+  start = rdtsc();
+  while(lapic[TCCR] != 0)
+    ;
+  tscperms = (rdtsc() - start) / MSPERTICK;
+}
+
 void
 lapicinit(void)
 {
@@ -65,8 +87,11 @@ lapicinit(void)
   // If xv6 cared more about precise timekeeping,
   // TICR would be calibrated using an external time source.
   lapicw(TDCR, X1);
+  // project1 scheduler: time quantum is charged in cycles (see sched)
+  if(tscperms == 0)
+    calibratetsc();
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TICR, TIMERCOUNT);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -160,6 +185,18 @@ lapicstartap(uchar apicid, uint addr)
   }
 }
 
+// Send the interrupt vector to the cpu with the apic id.
+void
+lapicipi(uchar apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 #define CMOS_STATA   0x0a
 #define CMOS_STATB   0x0b
 #define CMOS_UIP    (1 << 7)        // RTC update in progress
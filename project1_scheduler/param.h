@@ -11,6 +11,25 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define KMAXORDER    10  // largest kalloc_order() block is 2^KMAXORDER pages
+#define NSLEEPQ      64  // wait queues of sleep/wakeup, power of 2
 // project1 scheduler
-#define NQUEUE        3   // 3-level queue 
+#define NQUEUE        8   // max levels of the mlfq (setschedparams)
+#define NLEVEL        3   // 3-level queue by default
+#define NPRIORITY     4   // priorities in the last level (0 runs first)
+#define BOOSTINTERVAL 1000 // ms between priority boosts by default
+#ifndef HZ
+#define HZ            100 // timer ticks per second (make HZ=...), divides 1000
+#endif
+#define MSPERTICK     (1000 / HZ)
+#define USERHZ        100 // unit of sleep() and uptime(), independent of HZ
+#define RTBUDGET      950 // ms a cpu may run real-time processes per period
+#define RTPERIOD      1000 // ms
+#ifndef SCHEDPOLICY
+#define SCHEDPOLICY   SCHED_MLFQ // make STRIDE=1 for SCHED_STRIDE (sched.h)
+#endif
+#define TICKETS       100 // tickets of a process by default (stride)
+#define MAXTICKETS    1000
+#define STRIDE1       (1 << 20) // stride of a process with one ticket
+#define MIGRATIONCOST 10  // ms a process stays cache hot after running
 #define PASSWORD 2020002960 // student id for schedulerLock, schedulerUnlock
\ No newline at end of file
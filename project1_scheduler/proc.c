@@ -4,32 +4,50 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
-#include "proc.h"
+#include "traps.h"
 #include "spinlock.h"
+#include "proc.h"
 // #define DEBUG
 
 struct
 {
   struct spinlock lock;
   struct proc proc[NPROC];
-  struct queue queue[NQUEUE];
-  int lockpid;
+  uint boosttime;   // ms since the last priority boost
+  uint latency[NLATENCY];   // wakeup latency histogram (see sched.h)
+  struct proc *sleepq[NSLEEPQ];   // sleeping processes hashed by chan
 } ptable;
 
 static struct proc *initproc;
 
+// project1 scheduler
+// parameters of the mlfq, changed by setschedparams
+// written with ptable lock acquired
+struct schedparams schedparams;
+
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void idle(struct cpu *c);
+static void countRun(struct proc *p);
+static void chargeTime(struct proc *p);
+static struct proc *stealable(struct cpu *c, struct cpu *from);
 
 void pinit(void)
 {
   initlock(&ptable.lock, "ptable");
-  for (int i = 0; i < NQUEUE; ++i) {
-    ptable.queue[i].level = i;
-  }
+  schedparams.policy = SCHEDPOLICY;
+  schedparams.nlevel = NLEVEL;
+  for (int i = 0; i < NQUEUE; ++i)
+    schedparams.quantum[i] = (2 * i + 4) * 10;
+  schedparams.boostinterval = BOOSTINTERVAL;
+  schedparams.rtbudget = RTBUDGET;
+  schedparams.rtperiod = RTPERIOD;
+  schedparams.migrationcost = MIGRATIONCOST;
+  for (struct cpu *c = cpus; c < &cpus[NCPU]; ++c)
+    initrunqueue(&c->rq);
 }
 
 // Must be called with interrupts disabled
@@ -96,14 +114,26 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->bigpages = 0;
 
   // project1 scheduler
-  // initialize priority, prev, next, queue of the process
-  // push the process into L0 queue
+  // initialize priority, level, prev, next, queue of the process
+  // the process is pushed into L0 queue of this cpu (the parent's cpu
+  // for fork) when it becomes RUNNABLE
   p->priority = 3;
+  p->level = 0;
   p->next = p->prev = NULL;
+  p->queue = NULL;
   p->tq = 0;
-  pushqueue(ptable.queue, p);
+  p->tqcycles = 0;
+  p->cpu = mycpu();
+  memset(&p->stats, 0, sizeof(p->stats));
+  p->woken = false;
+  p->rt = false;
+  p->tickets = TICKETS;
+  p->pass = 0;
+  p->heapidx = -1;
+  p->lastrun = 0;
 
   release(&ptable.lock);
 
@@ -164,7 +194,7 @@ void userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  makeRunnable(p);
 
   release(&ptable.lock);
 }
@@ -179,8 +209,12 @@ int growproc(int n)
   sz = curproc->sz;
   if (n > 0)
   {
-    if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // the pages are mapped on first touch, see trap()
+    if (sz + n >= KERNBASE)
       return -1;
+    if (curproc->bigpages)
+      allocbiguvm(curproc->pgdir, sz, sz + n);
+    sz += n;
   }
   else if (n < 0)
   {
@@ -215,6 +249,8 @@ int fork(void)
     np->state = UNUSED;
     return -1;
   }
+  // the pages of the parent went read-only
+  lcr3(V2P(curproc->pgdir));
   np->sz = curproc->sz;
   np->parent = curproc;
   *np->tf = *curproc->tf;
@@ -229,11 +265,73 @@ int fork(void)
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
+  np->bigpages = curproc->bigpages;
+
+  // project1 scheduler
+  np->tickets = curproc->tickets;
+
   pid = np->pid;
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  makeRunnable(np);
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Create a process running the program at path with arguments argv,
+// without copying the caller first as fork() and exec() would. File
+// descriptor i of the new process is a dup of the caller's fdmap[i],
+// or closed if that is -1; with no fdmap it gets all of the caller's
+// descriptors, as in fork(). fdmap is kernel memory holding only -1 or
+// descriptor numbers. Returns the pid of the new process.
+int spawn(char *path, char **argv, int *fdmap)
+{
+  int i, fd, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if (fdmap)
+    for (i = 0; i < NOFILE; i++)
+      if (fdmap[i] != -1 && curproc->ofile[fdmap[i]] == 0)
+        return -1;
+
+  // Allocate process.
+  if ((np = allocproc()) == 0)
+  {
+    return -1;
+  }
+
+  // The segments and flags of a user trapframe; loadimage sets the rest.
+  *np->tf = *curproc->tf;
+  if (loadimage(np, path, argv) < 0)
+  {
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->parent = curproc;
+
+  for (i = 0; i < NOFILE; i++)
+  {
+    fd = fdmap ? fdmap[i] : i;
+    if (fd >= 0 && curproc->ofile[fd])
+      np->ofile[i] = filedup(curproc->ofile[fd]);
+  }
+  np->cwd = idup(curproc->cwd);
+
+  np->bigpages = curproc->bigpages;
+
+  // project1 scheduler
+  np->tickets = curproc->tickets;
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  makeRunnable(np);
   release(&ptable.lock);
 
   return pid;
@@ -269,14 +367,6 @@ void exit(void)
 
   acquire(&ptable.lock);
 
-  // schedulerUnlock manually
-  if (ptable.lockpid == curproc->pid) {
-    release(&ptable.lock);
-    // lockpid does not change between release and schedulerLock
-    schedulerUnlock(PASSWORD);
-    acquire(&ptable.lock);
-  }
-  
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
@@ -318,10 +408,6 @@ int wait(void)
       if (p->state == ZOMBIE)
       {
         // Found one.
-
-        // project1 scheduler 
-        // erase process from the queue
-        erasequeue(p->queue, p);
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
@@ -370,44 +456,30 @@ void scheduler(void)
     // Enable interrupts on this processor.
     sti();
 
-    // choose a process to run and check if the process has time quantum left
-    acquire(&ptable.lock);
-    for (;;)
-    {
-      p = getProcessToRun();
-      if (p == NULL)
-      {
-        break;
-      }
-      if (p->tq == getTimeQuantum(p->level))
-      {
-        expireTimeQuantum(p);
-      }
-      else
-        break;
-    }
+    // choose a process to run from the run queue of this cpu (or steal one)
+    // the chosen process is taken out of the run queue while it runs
+    // only the run queue locks are taken, so idle cpus do not spin on ptable.lock
+    p = getProcessToRun(c);
 
     if (p == NULL)
     {
-      release(&ptable.lock);
-
-      acquire(&tickslock);
-      uint xticks = ticks;
-      release(&tickslock);
-      if (xticks >= 100) boostPriority();      
+      idle(c);
       continue;
     }
 
-    // mark that the process used one tick
-    ++p->tq;
+    // p was RUNNABLE out of any run queue, so no one else can run it.
+    // ptable.lock makes sure that the cpu it yielded on has finished
+    // saving its context
+    acquire(&ptable.lock);
+
+    // a stolen process stays on this cpu from now on
+    if (p->cpu != c)
+      ++p->stats.migrations;
+    p->cpu = c;
 
-    // for ROUND ROBIN in L0, L1
-    // move the process to back of the queue
-    if (p->level < NQUEUE - 1) {
-      struct queue* tmp = p->queue;
-      erasequeue(p->queue, p);
-      pushqueue(tmp, p);
-    }
+    // ROUND ROBIN in L0, L1 comes from pushing it to the back when it yields
+    // the time it runs is charged to p->tq in sched()
+    countRun(p);
 
     // Switch to chosen process.  It is the process's job
     // to release ptable.lock and then reacquire it
@@ -420,6 +492,7 @@ void scheduler(void)
     c->proc = p;
     switchuvm(p);
     p->state = RUNNING;
+    p->runstart = rdtsc();
     swtch(&(c->scheduler), p->context);
     switchkvm();
 
@@ -428,12 +501,6 @@ void scheduler(void)
     c->proc = 0;
 
     release(&ptable.lock);
-
-    acquire(&tickslock);
-    uint xticks = ticks;
-    release(&tickslock);
-    if (xticks >= 100) boostPriority();      
-
   }
 }
 
@@ -457,16 +524,23 @@ void sched(void)
     panic("sched running");
   if (readeflags() & FL_IF)
     panic("sched interruptible");
+  chargeTime(p);
+  p->lastrun = ticks;
   intena = mycpu()->intena;
   swtch(&p->context, mycpu()->scheduler);
   mycpu()->intena = intena;
 }
 
 // Give up the CPU for one scheduling round.
-void yield(void)
+// voluntary for the yield system call, not on a timer tick
+void yield(int voluntary)
 {
   acquire(&ptable.lock); // DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  if (voluntary)
+    ++myproc()->stats.voluntary;
+  else
+    ++myproc()->stats.forced;
+  makeRunnable(myproc());
   sched();
   release(&ptable.lock);
 }
@@ -491,6 +565,42 @@ void forkret(void)
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// Wait queue of the sleepers on chan, shared by the channels with the
+// same hash.
+static struct proc **
+sleepqueue(void *chan)
+{
+  uint h = (uint)chan >> 2;
+
+  return &ptable.sleepq[(h ^ (h >> 7) ^ (h >> 14)) & (NSLEEPQ - 1)];
+}
+
+// The ptable lock must be held.
+static void
+pushsleep(struct proc *p)
+{
+  struct proc **q = sleepqueue(p->chan);
+
+  p->sleepprev = 0;
+  p->sleepnext = *q;
+  if (*q)
+    (*q)->sleepprev = p;
+  *q = p;
+}
+
+// The ptable lock must be held.
+static void
+erasesleep(struct proc *p)
+{
+  if (p->sleepprev)
+    p->sleepprev->sleepnext = p->sleepnext;
+  else
+    *sleepqueue(p->chan) = p->sleepnext;
+  if (p->sleepnext)
+    p->sleepnext->sleepprev = p->sleepprev;
+  p->sleepprev = p->sleepnext = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk)
@@ -509,14 +619,17 @@ void sleep(void *chan, struct spinlock *lk)
   // guaranteed that we won't miss any wakeup
   // (wakeup runs with ptable.lock locked),
   // so it's okay to release lk.
-  if (lk != &ptable.lock)
-  {                        // DOC: sleeplock0
+  if (lk != &ptable.lock)   // DOC: sleeplock0
     acquire(&ptable.lock); // DOC: sleeplock1
-    release(lk);
-  }
   // Go to sleep.
+  // Queued before lk is released, so a wakeup(chan) called with lk
+  // held either finds this process or comes before the sleep.
   p->chan = chan;
+  pushsleep(p);
+  if (lk != &ptable.lock)
+    release(lk);
   p->state = SLEEPING;
+  ++p->stats.voluntary;
 
   sched();
 
@@ -534,19 +647,32 @@ void sleep(void *chan, struct spinlock *lk)
 // PAGEBREAK!
 //  Wake up all processes sleeping on chan.
 //  The ptable lock must be held.
+//  Only walks the wait queue of chan.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *next;
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if (p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  for (p = *sleepqueue(chan); p; p = next)
+  {
+    next = p->sleepnext;
+    if (p->chan == chan)
+    {
+      erasesleep(p);
+      p->woken = true;
+      makeRunnable(p);
+    }
+  }
 }
 
 // Wake up all processes sleeping on chan.
+// Every caller holds the lock the sleepers passed to sleep(), and a
+// sleeper is queued before it releases that lock, so an empty wait
+// queue means there is no one to wake and ptable.lock is not taken.
 void wakeup(void *chan)
 {
+  if (*sleepqueue(chan) == 0)
+    return;
   acquire(&ptable.lock);
   wakeup1(chan);
   release(&ptable.lock);
@@ -567,7 +693,11 @@ int kill(int pid)
       p->killed = 1;
       // Wake process from sleep if necessary.
       if (p->state == SLEEPING)
-        p->state = RUNNABLE;
+      {
+        erasesleep(p);
+        p->woken = true;
+        makeRunnable(p);
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -602,6 +732,10 @@ void procdump(void)
     else
       state = "???";
     cprintf("%d %s %s L%d, tq %d / %d, priority %d", p->pid, state, p->name, p->level, p->tq, getTimeQuantum(p->level), p->priority);
+    if (schedparams.policy == SCHED_STRIDE)
+      cprintf(", tickets %d, pass %d", p->tickets, p->pass);
+    if (p->rt)
+      cprintf(", real-time");
     if (p->state == SLEEPING)
     {
       getcallerpcs((uint *)p->context->ebp + 2, pc);
@@ -610,15 +744,24 @@ void procdump(void)
     }
     cprintf("\n");
   }
+  kallocdump();
+#ifdef DEBUG_QUEUES
+  struct cpu *c;
+  for (c = cpus; c < &cpus[ncpu]; c++)
+  {
+    if (checkrunqueue(&c->rq) < 0)
+      cprintf("cpu %d: run queue is inconsistent\n", c - cpus);
+  }
+#endif
 }
 
 // functions for 
 // project1 scheduler
 
-// calculates time quantum for each level
+// time quantum for each level
 int getTimeQuantum(int i)
 {
-  return 2 * i + 4;
+  return schedparams.quantum[i];
 }
 
 // when called, ptable lock must be acquired
@@ -636,101 +779,281 @@ struct proc *getProc(int pid)
   return NULL;
 }
 
+// true if getProcessToRun would find a process for c: one it may run in
+// its own run queue, or one stealProcess would take from another cpu
+// a cache hot or throttled process does not count, it waits for a tick
+static bool existRunnable(struct cpu *c)
+{
+  struct proc *p;
+
+  acquire(&c->rq.lock);
+  p = frontrunqueue(&c->rq, !c->rtthrottled);
+  release(&c->rq.lock);
+  if (p)
+    return true;
+  // sizes are read without locks, it is only a hint
+  for (struct cpu *cc = cpus; cc < &cpus[ncpu]; ++cc)
+  {
+    if (cc == c || cc->rq.size == 0)
+      continue;
+    acquire(&cc->rq.lock);
+    p = stealable(c, cc);
+    release(&cc->rq.lock);
+    if (p)
+      return true;
+  }
+  return false;
+}
+
+// called in scheduler when there is no process to run
+// halts the cpu until the next interrupt, which is a timer tick or
+// a reschedule ipi from kickCpu
+static void idle(struct cpu *c)
+{
+  cli();
+  // xchg is a full barrier, so either kickCpu sees idle set or
+  // this cpu sees the process it queued
+  xchg(&c->idle, 1);
+  if (existRunnable(c))
+    sti();
+  else
+    stihlt();
+  c->idle = 0;
+}
+
 // when called, ptable lock must be acquired
-// called in boostPriority function for every process
-// clears priority, tq
-// move to L0 queue
-void clearProc(struct proc *p)
+// a process was queued on target, wakes up a halted cpu to run it.
+// if target is busy, an idle cpu can steal the process.
+// a real-time process preempts the mlfq process running on target
+static void kickCpu(struct cpu *target, bool rt)
 {
-  if (p == NULL || p->state == UNUSED)
+  struct cpu *me = mycpu();
+
+  // c->proc is written with ptable lock acquired
+  if (rt && !target->idle && !target->rtthrottled &&
+      target->proc && !target->proc->rt)
+  {
+    if (target != me)
+      lapicipi(target->apicid, T_IRQ0 + IRQ_RESCHED);
     return;
-  p->priority = 3;
-  p->tq = 0;
-  erasequeue(p->queue, p);
-  pushqueue(ptable.queue, p);
+  }
+  if (!target->idle)
+  {
+    for (target = cpus; target < &cpus[ncpu]; ++target)
+      if (target->idle)
+        break;
+    if (target == &cpus[ncpu])
+      return;
+  }
+  // an interrupt on this cpu has already woken it up
+  if (target != me)
+    lapicipi(target->apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
+// when called, ptable lock must be acquired
+// marks the process RUNNABLE and pushes it to the back of its queue
+// in the run queue of its cpu.
+// if it used up its time quantum, moves to lower level or change priority first
+void makeRunnable(struct proc *p)
+{
+  struct runqueue *rq = &p->cpu->rq;
+
+  p->state = RUNNABLE;
+  // ticks is read without tickslock, which is taken before ptable lock
+  p->readytick = ticks;
+  if (!p->rt && schedparams.policy == SCHED_MLFQ &&
+      p->tq >= getTimeQuantum(p->level))
+    expireTimeQuantum(p);
+
+  acquire(&rq->lock);
+  pushrunqueue(rq, p);
+  release(&rq->lock);
+
+  // a yielding process is queued on its own cpu, which schedules right away
+  if (p != myproc())
+    kickCpu(p->cpu, p->rt);
+}
+
+// when called, ptable lock must be acquired
+// takes the process out of the run queue of its cpu and returns true
+// if it is in the run queue. returns false if it is not RUNNABLE or
+// a scheduler has already taken it out to run it
+static bool dequeueProc(struct proc *p)
+{
+  struct runqueue *rq = &p->cpu->rq;
+  bool queued;
+
+  acquire(&rq->lock);
+  queued = p->queue != NULL || p->heapidx >= 0;
+  if (queued)
+    eraserunqueue(rq, p);
+  release(&rq->lock);
+  return queued;
+}
+
+// when called, ptable lock must be acquired
+// pushes back the process taken out by dequeueProc
+static void enqueueProc(struct proc *p)
+{
+  struct runqueue *rq = &p->cpu->rq;
+
+  acquire(&rq->lock);
+  pushrunqueue(rq, p);
+  release(&rq->lock);
+}
+
+// called by the timer interrupt on cpu 0 every tick
+// boosts priority every boost interval
+void schedulerTick(void)
+{
+  acquire(&ptable.lock);
+  ptable.boosttime += MSPERTICK;
+  if (ptable.boosttime >= schedparams.boostinterval)
+    boostPriority();
+  release(&ptable.lock);
+}
+
+// called by the timer interrupt on every cpu every tick
+// charges the tick to the real-time budget of this cpu if a real-time
+// process is running on it. once the budget is used up, real-time
+// processes wait on this cpu until the period ends
+void rtTick(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p = c->proc;
+
+  if (p && p->rt)
+  {
+    c->rtused += MSPERTICK;
+    if (c->rtused >= schedparams.rtbudget)
+      c->rtthrottled = 1;
+  }
+  c->rttime += MSPERTICK;
+  if (c->rttime >= schedparams.rtperiod)
+  {
+    c->rttime = 0;
+    c->rtused = 0;
+    c->rtthrottled = 0;
+  }
 }
 
 // when called, ptable lock must be acquired
-// called in scheduler() every 100 ticks ()
-// if scheduler is locked, unlock scheduler
-// move every process to L0 queue by calling clearProc function
+// called in schedulerTick() every boost interval and by setschedparams
+// splices the queues of every cpu onto its L0 queue and clears
+// priority, tq of every process, O(NCPU + NPROC)
 void boostPriority()
 {
 #ifdef DEBUG
   cprintf("[[[ boosting ]]]\n");
 #endif
-  acquire(&tickslock);
-  ticks = 0;
-  release(&tickslock);
+  ptable.boosttime = 0;
 
-  acquire(&ptable.lock);
-  if (ptable.lockpid) {
-    release(&ptable.lock);
-    // lockpid does not change between release and schedulerLock
-    schedulerUnlock(PASSWORD);
-    acquire(&ptable.lock);
+  for (struct cpu *c = cpus; c < &cpus[ncpu]; ++c)
+  {
+    acquire(&c->rq.lock);
+    boostrunqueue(&c->rq);
+    release(&c->rq.lock);
   }
 
-  for (int i = 0; i < NPROC; ++i)
+  // running, sleeping processes and the ones being picked
+  // go to L0 queue when they become RUNNABLE
+  for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; ++p)
   {
-    for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; ++p)
-    {
-      if (p->state != UNUSED)
-      {
-        clearProc(p);
-      }
-    }
+    if (p->state == UNUSED)
+      continue;
+    p->priority = 3;
+    p->tq = 0;
+    p->tqcycles = 0;
+    p->level = 0;
+    ++p->stats.boosts;
   }
+}
 
-  release(&ptable.lock);
+// true if the process stopped running less than the migration cost ago,
+// so its cache state is still on its cpu
+// lastrun is read without ptable lock, it is only a hint
+static bool cacheHot(struct proc *p)
+{
+  return (ticks - p->lastrun) * MSPERTICK < schedparams.migrationcost;
 }
 
-// when called, ptable lock must be acquired
-// called in scheduler function
-// returns a process to run (checking time quantum is not included)
-struct proc *getProcessToRun()
-{
-  if (ptable.lockpid) {
-    struct proc* p = getProc(ptable.lockpid);
-    if (p->state == RUNNABLE) return p;
-    else {
-      // unlock and get runnable process
-      cprintf("[WARN] Scheduler locked by process that is NOT RUNNABLE\n\tUnlocking scheduler for CPU utilization\n");
-      release(&ptable.lock);
-      schedulerUnlock(PASSWORD);
-      acquire(&ptable.lock);
-    }
-  }
-  struct proc *p = NULL;
-  for (;;)
-  {
-    for (int i = 0; i < NQUEUE - 1; ++i)
-    {
-      for (p = frontqueue(ptable.queue + i); p; p = p->next)
-      {
-        if (p->state != RUNNABLE)
-          continue;
-        return p;
-      }
-    }
+// when called, run queue lock of from must be acquired
+// the process c may take out of the run queue of from, or NULL
+// a throttled cpu does not take real-time processes
+static struct proc *stealable(struct cpu *c, struct cpu *from)
+{
+  struct proc *p = frontrunqueue(&from->rq, !c->rtthrottled);
+  // the process to run next there has waited the longest. if even it is
+  // cache hot, it is cheaper to let it wait than to move it
+  if (p && cacheHot(p))
+    p = NULL;
+  return p;
+}
 
-    int minPriority = 4;
-    for (struct proc *tmp = frontqueue(ptable.queue + NQUEUE - 1); tmp; tmp = tmp->next)
-    {
-      if (tmp->state != RUNNABLE)
-        continue;
-      if (tmp->priority < minPriority)
-      {
-        minPriority = tmp->priority;
-        p = tmp;
-      }
-    }
+static struct proc *stealFrom(struct cpu *c, struct cpu *from)
+{
+  struct proc *p;
+
+  acquire(&from->rq.lock);
+  p = stealable(c, from);
+  if (p)
+    eraserunqueue(&from->rq, p);
+  release(&from->rq.lock);
+  return p;
+}
+
+// takes a process out of the run queue of the busiest other cpu, or of
+// any other cpu if the busiest one has none to give
+// returns NULL if no cpu has a process that can be stolen
+static struct proc *stealProcess(struct cpu *c)
+{
+  struct cpu *busiest = NULL;
+  struct proc *p;
+
+  // sizes are read without locks, it is only a hint
+  for (struct cpu *cc = cpus; cc < &cpus[ncpu]; ++cc)
+  {
+    if (cc == c || cc->rq.size == 0)
+      continue;
+    if (busiest == NULL || cc->rq.size > busiest->rq.size)
+      busiest = cc;
+  }
+  if (busiest == NULL)
+    return NULL;
+  if ((p = stealFrom(c, busiest)) != NULL)
     return p;
+  for (struct cpu *cc = cpus; cc < &cpus[ncpu]; ++cc)
+  {
+    if (cc == c || cc == busiest || cc->rq.size == 0)
+      continue;
+    if ((p = stealFrom(c, cc)) != NULL)
+      return p;
   }
+  return NULL;
+}
+
+// when called, ptable lock must NOT be acquired
+// called in scheduler function
+// returns a process to run taken out of its run queue
+struct proc *getProcessToRun(struct cpu *c)
+{
+  struct proc *p;
+
+  // front of the first non-empty queue, real-time ones first unless
+  // this cpu used up its real-time budget
+  // L2 is bucketed by priority, so this is the minimum priority in L2
+  acquire(&c->rq.lock);
+  p = poprunqueue(&c->rq, !c->rtthrottled);
+  release(&c->rq.lock);
+
+  if (p == NULL)
+    p = stealProcess(c);
+  return p;
 }
 
 // when called, ptable lock must be acquired
-// moves to lower queue or change priority
+// called in makeRunnable for a process that is not in the run queue
+// moves to lower level or change priority
 void expireTimeQuantum(struct proc *p)
 {
 #ifdef DEBUG
@@ -738,17 +1061,56 @@ void expireTimeQuantum(struct proc *p)
   procdump();
 #endif
   p->tq = 0;
-  if (p->level < NQUEUE - 1)
+  p->tqcycles = 0;
+  if (p->level < schedparams.nlevel - 1)
+    ++p->level;
+  else if (p->priority > 0)
+    --p->priority;
+  else
+    return;
+  ++p->stats.demotions;
+}
+
+// when called, ptable lock must be acquired
+// called in sched when the process stops running
+// charges the cycles it actually ran to its time quantum in ms, so
+// a process that blocks right after being picked keeps its level.
+// the pass of stride scheduling advances by its stride for every ms
+static void chargeTime(struct proc *p)
+{
+  uint ms;
+
+  // no time stamp counter calibration, charge a tick for every run
+  if (tscperms == 0)
+    ms = MSPERTICK;
+  else
   {
-    struct queue* tmpq = p->queue;
-    erasequeue(p->queue, p);
-    pushqueue(tmpq + 1, p);
+    p->tqcycles += rdtsc() - p->runstart;
+    ms = p->tqcycles / tscperms;
+    p->tqcycles %= tscperms;
   }
-  else
+  p->tq += ms;
+  p->stats.leveltime[p->level] += ms;
+  p->pass += ms * (STRIDE1 / p->tickets);
+}
+
+// when called, ptable lock must be acquired
+// called in scheduler when the process is about to run
+// counts how long it waited as RUNNABLE
+static void countRun(struct proc *p)
+{
+  uint wait = (ticks - p->readytick) * MSPERTICK;
+  int i;
+
+  p->stats.waittime += wait;
+  ++p->stats.nwait;
+
+  if (p->woken)
   {
-    if (p->priority == 0)
-      return;
-    --p->priority;
+    for (i = 0; wait && i < NLATENCY - 1; ++i)
+      wait >>= 1;
+    ++ptable.latency[i];
+    p->woken = false;
   }
 }
 
@@ -757,9 +1119,12 @@ void expireTimeQuantum(struct proc *p)
 void printqueues()
 {
   cprintf("//\n");
-  printqueue(ptable.queue);
-  printqueue(ptable.queue + 1);
-  printqueue(ptable.queue + 2);
+  for (struct cpu *c = cpus; c < &cpus[ncpu]; ++c)
+  {
+    cprintf("cpu %d\n", c - cpus);
+    for (int i = 0; i < NRUNQUEUE; ++i)
+      printqueue(c->rq.queue + i);
+  }
   cprintf("//\n");
 }
 
@@ -772,7 +1137,7 @@ int getLevel()
     return -1;
 
   int level = p->level;
-  if (level < 0 || level >= NQUEUE)
+  if (level < 0 || level >= schedparams.nlevel)
     return -1;
 
   return level;
@@ -788,8 +1153,13 @@ void setPriority(int pid, int priority)
   acquire(&ptable.lock);
 
   struct proc *p = getProc(pid);
-  if (p)
+  if (p) {
+    // a RUNNABLE process in L2 moves to the bucket of the new priority
+    bool requeue = p->level == schedparams.nlevel - 1 && dequeueProc(p);
     p->priority = priority;
+    if (requeue)
+      enqueueProc(p);
+  }
   else {
     cprintf("[WARN] Invalid pid\n\tPlease use ");
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
@@ -803,7 +1173,9 @@ void setPriority(int pid, int priority)
 }
 
 // locks scheduler
-// scheduler can only run current process
+// the current process becomes real-time: it runs before every mlfq
+// process, in fifo order with other real-time processes, within the
+// real-time budget of its cpu (see rtTick)
 void schedulerLock(int password)
 {
 
@@ -819,36 +1191,25 @@ void schedulerLock(int password)
     return;
   }
   
-  if (ptable.lockpid == p->pid) {
+  if (p->rt) {
     cprintf("[WARN] Imprudent locking\n\tThis can affect performance of other processes\n");
   }
-  else if (ptable.lockpid) {
-    // this never happens because other processes cannot get CPU from scheduler(single core)
-    cprintf("[ERROR] Already Locked by another process\n");
-    p->killed = 1;
-
-    release(&ptable.lock);
-    return;
-  }
 
 #ifdef DEBUG
   cprintf("[[[ locking scheduler ]]]\n");
 #endif
-  ptable.lockpid = p->pid;
+  // p is running, so it goes into the real-time queue when it yields
+  p->rt = true;
 
   release(&ptable.lock);
 
-  acquire(&tickslock);
-  ticks = 0;
-  release(&tickslock);
-
   return;
 }
 
 // unlocks scheduler
 // if wrong password, print error message and exit
-// if password is correct and called by process that has locked the scheduler,
-// back to mlfq, current process to L0 front
+// if password is correct and called by a real-time process,
+// back to mlfq, current process to L0
 void schedulerUnlock(int password)
 {
   struct proc *p = myproc();
@@ -863,38 +1224,25 @@ void schedulerUnlock(int password)
     return;
   }
 
-
-  if (ptable.lockpid == 0)
-  {
-    cprintf("[WARN] Trying to unlock scheduler (currently not locked)\n");
-
-    release(&ptable.lock);
-    return;
-  }
-
-  if (p && p->pid != ptable.lockpid)
+  if (!p->rt)
   {
     cprintf("[WARN] Trying to unlock scheduler (not locked by this process)\n");
-    cprintf("\tCurrent lockpid : %d, tried locking by %d\n", ptable.lockpid, p->pid);
 
     release(&ptable.lock);
     return;
   }
 
-  if (p) {
-    erasequeue(p->queue, p);
-    pushfrontqueue(ptable.queue, p);
-
-    p->priority = 3;
-    p->tq = 0;
-  }
+  // p is running, so it goes into L0 queue when it yields
+  p->rt = false;
+  p->level = 0;
+  p->priority = 3;
+  p->tq = 0;
+  p->tqcycles = 0;
 
 #ifdef DEBUG
   cprintf("[[[ unlocking scheduler ]]]\n");
 #endif
 
-  ptable.lockpid = 0;
-
   release(&ptable.lock);
 
   return;
@@ -904,19 +1252,21 @@ void schedulerUnlock(int password)
 // moves to queue of that level
 void setLevel(int pid, int level) {
 
-  if (level < 0 || level > 3) {
+  acquire(&ptable.lock);
+
+  if (level < 0 || level >= schedparams.nlevel) {
     cprintf("[WARN] Invalid level\n");
-    cprintf("\tPlease use 0, 1, 2 as level.\n");
+    cprintf("\tPlease use 0 ~ %d as level.\n", schedparams.nlevel - 1);
+    release(&ptable.lock);
     return;
   }
 
-  acquire(&ptable.lock);
-
   struct proc *p = getProc(pid);
   if (p) {
-    erasequeue(p->queue, p);
-    pushqueue(ptable.queue + level, p);
-
+    bool queued = dequeueProc(p);
+    p->level = level;
+    if (queued)
+      enqueueProc(p);
   }
   else {
     cprintf("[WARN] Invalid pid\n\tPlease use ");
@@ -930,4 +1280,82 @@ void setLevel(int pid, int level) {
 
   release(&ptable.lock);
   return;
-}
\ No newline at end of file
+}
+
+// sets the policy, the number of levels, time quantum of each level
+// and boost interval
+// boosts priority so that no process is left in a removed level, and
+// moves the queued processes over if the policy changes
+// returns -1 if the parameters are invalid
+int setschedparams(struct schedparams *sp)
+{
+  if (sp->policy != SCHED_MLFQ && sp->policy != SCHED_STRIDE)
+    return -1;
+  if (sp->nlevel < 1 || sp->nlevel > NQUEUE || sp->boostinterval < 1)
+    return -1;
+  if (sp->rtbudget < 1 || sp->rtperiod < sp->rtbudget || sp->migrationcost < 0)
+    return -1;
+  for (int i = 0; i < sp->nlevel; ++i)
+    if (sp->quantum[i] < 1)
+      return -1;
+
+  acquire(&ptable.lock);
+  bool switched = schedparams.policy != sp->policy;
+  schedparams = *sp;
+  if (switched)
+  {
+    for (struct cpu *c = cpus; c < &cpus[ncpu]; ++c)
+    {
+      acquire(&c->rq.lock);
+      requeuerunqueue(&c->rq);
+      release(&c->rq.lock);
+    }
+  }
+  boostPriority();
+  release(&ptable.lock);
+  return 0;
+}
+
+void getschedparams(struct schedparams *sp)
+{
+  acquire(&ptable.lock);
+  *sp = schedparams;
+  release(&ptable.lock);
+}
+
+// copies the counters of the process and the wakeup latency histogram
+// returns -1 if there is no process with the pid
+int getschedstats(int pid, struct schedstats *st)
+{
+  acquire(&ptable.lock);
+  struct proc *p = getProc(pid);
+  if (p == NULL)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  st->proc = p->stats;
+  memmove(st->latency, ptable.latency, sizeof(st->latency));
+  release(&ptable.lock);
+  return 0;
+}
+
+// sets the tickets of the process for stride scheduling
+// the stride changes from its next run, its pass is kept
+// returns -1 if there is no process with the pid or tickets are invalid
+int settickets(int pid, int tickets)
+{
+  if (tickets < 1 || tickets > MAXTICKETS)
+    return -1;
+
+  acquire(&ptable.lock);
+  struct proc *p = getProc(pid);
+  if (p == NULL)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  p->tickets = tickets;
+  release(&ptable.lock);
+  return 0;
+}
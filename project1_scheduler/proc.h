@@ -1,3 +1,37 @@
+// project1 scheduler
+#include <stddef.h>
+#include <stdbool.h>
+#include "sched.h"
+
+struct queue
+{
+  struct proc *front;
+  struct proc *back;
+  int level;                    // index in the run queue, for printing
+  int size;
+};
+
+// run queues of the mlfq, only RUNNABLE processes are in them
+// queue[RTQUEUE] is the fifo of real-time processes, above L0.
+// L0 ~ L(nlevel - 2) are round robin queues and the last level is split
+// into one bucket per priority, kept at the end so that queue[] is in
+// the order of scheduling for any nlevel (see schedparams).
+// the process to run is the front of the first non-empty queue
+#define RTQUEUE   0
+#define NRUNQUEUE (1 + NQUEUE - 1 + NPRIORITY)
+
+struct runqueue
+{
+  struct spinlock lock;         // protects the queues, taken after ptable.lock
+  struct queue queue[NRUNQUEUE];
+  uint bitmap;                  // bit i is set if queue[i] is not empty
+  int size;                     // number of processes in the queues and heap
+  // stride scheduling, below the real-time queue
+  struct proc *heap[NPROC];     // min-heap of pass values
+  int nheap;
+  uint pass;                    // pass of the process popped last
+};
+
 // Per-CPU state
 struct cpu {
   uchar apicid;                // Local APIC ID
@@ -8,6 +42,11 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  struct runqueue rq;          // project1 scheduler: mlfq of this cpu
+  volatile uint idle;          // project1 scheduler: halted in scheduler()
+  int rttime;                  // project1 scheduler: ms into the rt period
+  int rtused;                  // project1 scheduler: ms of rt run in the period
+  int rtthrottled;             // project1 scheduler: rt budget used up
 };
 
 extern struct cpu cpus[NCPU];
@@ -45,17 +84,31 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *sleepprev;      // wait queue of chan
+  struct proc *sleepnext;
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int bigpages;                // heap grows by 4 MiB pages where aligned
   // project1 scheduler
-  int level;                    // queue level
+  int level;                    // queue level (kept while not in a queue)
   int priority;                 // for scheduler
   struct proc* prev;            // for queue
   struct proc* next;            // for queue
-  int tq;                       // time quantum
-  struct queue* queue;          // queue
+  int tq;                       // time quantum (ms used)
+  uint tqcycles;                // cycles used on top of tq
+  uint runstart;                // rdtsc() when it started running
+  struct queue* queue;          // queue, null unless RUNNABLE
+  struct cpu* cpu;              // cpu it ran on last, whose run queue it goes into
+  uint lastrun;                 // ticks when it stopped running
+  struct procstats stats;       // scheduling counters
+  uint readytick;               // ticks when it became RUNNABLE
+  bool woken;                   // became RUNNABLE by wakeup or kill
+  bool rt;                      // real-time, runs before the mlfq
+  int tickets;                  // share under stride scheduling
+  uint pass;                    // stride scheduling virtual time
+  int heapidx;                  // index in the heap of the run queue, -1 if not
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -63,15 +116,3 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
-
-// project1 scheduler
-#include <stddef.h>
-#include <stdbool.h>
-
-struct queue
-{
-  struct proc *front;
-  struct proc *back;
-  int level;
-  int size;
-};
@@ -6,8 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
-#include "proc.h"
 #include "spinlock.h"
+#include "proc.h"
 
 void printqueue(struct queue *q)
 {
@@ -19,61 +19,28 @@ void printqueue(struct queue *q)
   cprintf("\n");
 }
 
+// O(1), membership is tracked by p->queue
 void erasequeue(struct queue *q, struct proc *p)
 {
-  if (p->queue != q) {
-    panic("erasequeue:");
-  }
   if (q == NULL || p == NULL)
     return;
-  bool found = 0;
-  for (struct proc *pp = frontqueue(q); pp; pp = pp->next)
-  {
-    if (pp == p)
-    {
-      found = 1;
-      break;
-    }
-  }
-  if (!found)
-  {
-    procdump();
-    cprintf("pid = %d\n", p->pid);
-    panic("not in queue\n");
-  }
-  p->queue = NULL;
-  p->level = -1;
-  --q->size;
-  if (q->front == q->back)
-  {
-    q->front = q->back = NULL;
-
-    p->prev = p->next = NULL;
-    return;
-  }
-  if (q->front == p)
-  {
+  if (p->queue != q)
+    panic("erasequeue");
+#ifdef DEBUG_QUEUES
+  if (checkqueue(q) < 0)
+    panic("erasequeue: inconsistent queue");
+#endif
+  if (p->prev)
+    p->prev->next = p->next;
+  else
     q->front = p->next;
-    q->front->prev = NULL;
-    p->prev = p->next = NULL;
-    return;
-  }
-  if (q->back == p)
-  {
+  if (p->next)
+    p->next->prev = p->prev;
+  else
     q->back = p->prev;
-    q->back->next = NULL;
-    p->prev = p->next = NULL;
-    return;
-  }
-  if (p->prev == NULL || p->next == NULL)
-  {
-    procdump();
-    cprintf("pid %d, level %d,prevnull %d, nextnull %d\n", p->pid, p->level, p->prev == NULL, p->next == NULL);
-    panic("should have prev and next\n");
-  }
-  p->prev->next = p->next;
-  p->next->prev = p->prev;
   p->prev = p->next = NULL;
+  p->queue = NULL;
+  --q->size;
 }
 
 void pushqueue(struct queue *q, struct proc *n)
@@ -84,8 +51,11 @@ void pushqueue(struct queue *q, struct proc *n)
     panic("pushqueue");
     return;
   }
+#ifdef DEBUG_QUEUES
+  if (checkqueue(q) < 0)
+    panic("pushqueue: inconsistent queue");
+#endif
   n->queue = q;
-  n->level = n->queue->level;
   ++q->size;
   n->prev = q->back;
   if (q->back == NULL)
@@ -106,8 +76,11 @@ struct proc *popqueue(struct queue *q)
   {
     return ret;
   }
+#ifdef DEBUG_QUEUES
+  if (checkqueue(q) < 0)
+    panic("popqueue: inconsistent queue");
+#endif
   ret->queue = NULL;
-  ret->level = -1;
 
   --q->size;
   if (q->front == q->back)
@@ -136,14 +109,13 @@ void pushfrontqueue(struct queue *q, struct proc *p)
   }
 
   p->queue = q;
-  p->level = p->queue->level;
+  ++q->size;
   if (q->front == NULL)
   {
     q->front = q->back = p;
     p->prev = p->next = NULL;
     return;
   }
-  ++q->size;
   if (q->front == q->back)
   {
     q->front = p;
@@ -159,3 +131,285 @@ void pushfrontqueue(struct queue *q, struct proc *p)
   p->next->prev = p;
   return;
 }
+
+// index of the queue in the runqueue that the process belongs to
+static int rqindex(struct proc *p)
+{
+  if (p->rt)
+    return RTQUEUE;
+  if (p->level < schedparams.nlevel - 1)
+    return 1 + p->level;
+  return NQUEUE + p->priority;
+}
+
+void initrunqueue(struct runqueue *rq)
+{
+  initlock(&rq->lock, "runqueue");
+  for (int i = 0; i < NRUNQUEUE; ++i)
+  {
+    rq->queue[i].front = rq->queue[i].back = NULL;
+    rq->queue[i].size = 0;
+    rq->queue[i].level = i;
+  }
+  rq->bitmap = 0;
+  rq->size = 0;
+  rq->nheap = 0;
+  rq->pass = 0;
+}
+
+// stride scheduling
+// pass values wrap around, so they are compared by their difference
+static bool passless(struct proc *a, struct proc *b)
+{
+  return (int)(a->pass - b->pass) < 0;
+}
+
+static void swapheap(struct runqueue *rq, int i, int j)
+{
+  struct proc *p = rq->heap[i];
+  rq->heap[i] = rq->heap[j];
+  rq->heap[j] = p;
+  rq->heap[i]->heapidx = i;
+  rq->heap[j]->heapidx = j;
+}
+
+static void siftup(struct runqueue *rq, int i)
+{
+  while (i > 0 && passless(rq->heap[i], rq->heap[(i - 1) / 2]))
+  {
+    swapheap(rq, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void siftdown(struct runqueue *rq, int i)
+{
+  for (;;)
+  {
+    int min = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < rq->nheap && passless(rq->heap[l], rq->heap[min]))
+      min = l;
+    if (r < rq->nheap && passless(rq->heap[r], rq->heap[min]))
+      min = r;
+    if (min == i)
+      return;
+    swapheap(rq, i, min);
+    i = min;
+  }
+}
+
+static void pushheap(struct runqueue *rq, struct proc *p)
+{
+  if (p->heapidx >= 0)
+    panic("pushheap");
+  // a process that slept or comes from another cpu does not catch up
+  // on the time it was away
+  if ((int)(p->pass - rq->pass) < 0)
+    p->pass = rq->pass;
+  p->heapidx = rq->nheap;
+  rq->heap[rq->nheap++] = p;
+  siftup(rq, p->heapidx);
+}
+
+static void eraseheap(struct runqueue *rq, struct proc *p)
+{
+  int i = p->heapidx;
+
+  if (i < 0 || i >= rq->nheap || rq->heap[i] != p)
+    panic("eraseheap");
+  --rq->nheap;
+  if (i < rq->nheap)
+  {
+    rq->heap[i] = rq->heap[rq->nheap];
+    rq->heap[i]->heapidx = i;
+    siftup(rq, i);
+    siftdown(rq, i);
+  }
+  p->heapidx = -1;
+}
+
+// when called, rq->lock must be acquired (same for functions below)
+// pushes the process to the back of the queue of its level (and priority)
+void pushrunqueue(struct runqueue *rq, struct proc *p)
+{
+  if (!p->rt && schedparams.policy == SCHED_STRIDE)
+  {
+    pushheap(rq, p);
+    ++rq->size;
+    return;
+  }
+  int i = rqindex(p);
+  pushqueue(rq->queue + i, p);
+  rq->bitmap |= 1 << i;
+  ++rq->size;
+}
+
+void eraserunqueue(struct runqueue *rq, struct proc *p)
+{
+  if (p->heapidx >= 0)
+  {
+    eraseheap(rq, p);
+    --rq->size;
+    return;
+  }
+  struct queue *q = p->queue;
+  erasequeue(q, p);
+  if (q->size == 0)
+    rq->bitmap &= ~(1 << (q - rq->queue));
+  --rq->size;
+}
+
+// pops the process to run next, skipping the real-time queue if rt is
+// false. real-time processes go first, then the minimum pass in the
+// stride heap in O(log n), then the mlfq in O(1)
+// returns NULL if there is no RUNNABLE process
+struct proc *poprunqueue(struct runqueue *rq, int rt)
+{
+  uint bitmap = rt ? rq->bitmap : rq->bitmap & ~(1 << RTQUEUE);
+  if (rq->nheap && !(bitmap & (1 << RTQUEUE)))
+  {
+    struct proc *p = rq->heap[0];
+    rq->pass = p->pass;
+    eraseheap(rq, p);
+    --rq->size;
+    return p;
+  }
+  if (bitmap == 0)
+    return NULL;
+  int i = bsf(bitmap);
+  struct proc *p = popqueue(rq->queue + i);
+  if (rq->queue[i].size == 0)
+    rq->bitmap &= ~(1 << i);
+  --rq->size;
+  return p;
+}
+
+// appends src to the back of dst and empties src
+void splicequeue(struct queue *dst, struct queue *src)
+{
+  if (src->front == NULL)
+    return;
+  for (struct proc *p = src->front; p; p = p->next)
+    p->queue = dst;
+  src->front->prev = dst->back;
+  if (dst->back)
+    dst->back->next = src->front;
+  else
+    dst->front = src->front;
+  dst->back = src->back;
+  dst->size += src->size;
+  src->front = src->back = NULL;
+  src->size = 0;
+}
+
+// for priority boosting
+// moves every mlfq process to the L0 queue, real-time ones stay
+// the caller sets their level to 0
+void boostrunqueue(struct runqueue *rq)
+{
+  struct queue *l0 = rq->queue + RTQUEUE + 1;
+
+  for (int i = RTQUEUE + 2; i < NRUNQUEUE; ++i)
+    splicequeue(l0, rq->queue + i);
+  rq->bitmap &= 1 << RTQUEUE;
+  if (l0->size)
+    rq->bitmap |= 1 << (RTQUEUE + 1);
+}
+
+// the process poprunqueue would return, left in the run queue
+struct proc *frontrunqueue(struct runqueue *rq, int rt)
+{
+  uint bitmap = rt ? rq->bitmap : rq->bitmap & ~(1 << RTQUEUE);
+  if (rq->nheap && !(bitmap & (1 << RTQUEUE)))
+    return rq->heap[0];
+  if (bitmap == 0)
+    return NULL;
+  return rq->queue[bsf(bitmap)].front;
+}
+
+// moves every process but real-time ones to where pushrunqueue puts it
+// under the current policy, called when the policy changes
+void requeuerunqueue(struct runqueue *rq)
+{
+  struct proc *procs[NPROC];
+  struct proc *p;
+  int n = 0;
+
+  while ((p = poprunqueue(rq, 0)) != NULL)
+    procs[n++] = p;
+  for (int i = 0; i < n; ++i)
+    pushrunqueue(rq, procs[i]);
+}
+
+#ifdef DEBUG_QUEUES
+// walks the whole queue and checks links, membership and size
+// prints the first inconsistency and returns -1, 0 if consistent
+int checkqueue(struct queue *q)
+{
+  struct proc *prev = NULL;
+  int n = 0;
+
+  if (q->front && q->front->prev) {
+    cprintf("checkqueue: queue %d front pid %d has prev\n", q->level, q->front->pid);
+    return -1;
+  }
+  for (struct proc *p = q->front; p; prev = p, p = p->next)
+  {
+    if (p->queue != q) {
+      cprintf("checkqueue: queue %d pid %d is not in this queue\n", q->level, p->pid);
+      return -1;
+    }
+    if (p->prev != prev) {
+      cprintf("checkqueue: queue %d pid %d has wrong prev\n", q->level, p->pid);
+      return -1;
+    }
+    if (++n > NPROC) {
+      cprintf("checkqueue: queue %d has a cycle\n", q->level);
+      return -1;
+    }
+  }
+  if (q->back != prev) {
+    cprintf("checkqueue: queue %d back is not the last process\n", q->level);
+    return -1;
+  }
+  if (q->size != n) {
+    cprintf("checkqueue: queue %d size %d, but %d processes\n", q->level, q->size, n);
+    return -1;
+  }
+  return 0;
+}
+
+// checks every queue and the bitmap, size of the run queue
+int checkrunqueue(struct runqueue *rq)
+{
+  int size = 0;
+
+  for (int i = 0; i < NRUNQUEUE; ++i)
+  {
+    if (checkqueue(rq->queue + i) < 0)
+      return -1;
+    if (!(rq->bitmap & (1 << i)) != (rq->queue[i].size == 0)) {
+      cprintf("checkrunqueue: bitmap %x, but queue %d has size %d\n", rq->bitmap, i, rq->queue[i].size);
+      return -1;
+    }
+    size += rq->queue[i].size;
+  }
+  for (int i = 0; i < rq->nheap; ++i)
+  {
+    if (rq->heap[i]->heapidx != i) {
+      cprintf("checkrunqueue: heap %d pid %d has index %d\n", i, rq->heap[i]->pid, rq->heap[i]->heapidx);
+      return -1;
+    }
+    if (i > 0 && passless(rq->heap[i], rq->heap[(i - 1) / 2])) {
+      cprintf("checkrunqueue: heap %d pid %d passes its parent\n", i, rq->heap[i]->pid);
+      return -1;
+    }
+  }
+  size += rq->nheap;
+  if (rq->size != size) {
+    cprintf("checkrunqueue: size %d, but %d processes\n", rq->size, size);
+    return -1;
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,39 @@
+// project1 scheduler
+// parameters of the mlfq, shared with user programs
+// param.h must be included before this file
+
+#define SCHED_MLFQ    0       // multi-level feedback queue
+#define SCHED_STRIDE  1       // stride scheduling by tickets (settickets)
+
+struct schedparams {
+  int policy;                 // SCHED_MLFQ or SCHED_STRIDE
+  int nlevel;                 // number of levels, 1 ~ NQUEUE
+  int quantum[NQUEUE];        // time quantum of each level (ms)
+  int boostinterval;          // ms between priority boosts
+  int rtbudget;               // ms each cpu runs real-time processes per period
+  int rtperiod;               // ms
+  int migrationcost;          // ms after running that a process is not stolen
+};
+
+#define NLATENCY      8       // buckets of the wakeup latency histogram
+
+// scheduling counters of a process
+struct procstats {
+  uint leveltime[NQUEUE];     // ms run in each level
+  uint demotions;             // time quantum expired and level or priority lowered
+  uint boosts;                // priority boosts
+  uint voluntary;             // gave up the cpu by sleeping or the yield system call
+  uint forced;                // preempted by a timer tick
+  uint waittime;              // ms spent RUNNABLE before running
+  uint nwait;                 // times from RUNNABLE to RUNNING
+  uint migrations;            // ran on a different cpu than last time
+};
+
+// returned by getschedstats
+struct schedstats {
+  struct procstats proc;      // counters of the process
+  // wakeup (SLEEPING -> RUNNABLE) to RUNNING latency of the whole kernel
+  // latency[0] counts 0 ms, latency[i] counts 2^(i-1) ~ 2^i - 1 ms
+  // and the last one counts everything longer
+  uint latency[NLATENCY];
+};
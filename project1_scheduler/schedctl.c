@@ -0,0 +1,76 @@
+// project1 scheduler
+// prints or sets the parameters of the mlfq
+// usage : schedctl                     prints the parameters
+//         schedctl boost q0 [q1 ...]   sets the boost interval and the time
+//                                      quantum of each level (number of levels)
+//                                      in ms
+//         schedctl rt budget period    sets the ms each cpu may run
+//                                      real-time processes per period
+//         schedctl mlfq | stride       selects the scheduling policy
+//         schedctl migration ms        sets how long a process stays cache
+//                                      hot, and is not stolen, after running
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "sched.h"
+
+void printparams(struct schedparams *sp)
+{
+  int i;
+
+  printf(1, "policy %s\n", sp->policy == SCHED_STRIDE ? "stride" : "mlfq");
+  printf(1, "levels %d, boost interval %d ms\n", sp->nlevel, sp->boostinterval);
+  for (i = 0; i < sp->nlevel; i++)
+    printf(1, "L%d time quantum %d ms\n", i, sp->quantum[i]);
+  printf(1, "real-time budget %d ms per %d ms\n", sp->rtbudget, sp->rtperiod);
+  printf(1, "migration cost %d ms\n", sp->migrationcost);
+}
+
+int main(int argc, char *argv[])
+{
+  struct schedparams sp;
+  int i;
+
+  getschedparams(&sp);
+  if (argc == 1)
+  {
+    printparams(&sp);
+    exit();
+  }
+  if (argc == 2 && strcmp(argv[1], "mlfq") == 0)
+    sp.policy = SCHED_MLFQ;
+  else if (argc == 2 && strcmp(argv[1], "stride") == 0)
+    sp.policy = SCHED_STRIDE;
+  else if (argc == 3 && strcmp(argv[1], "migration") == 0)
+    sp.migrationcost = atoi(argv[2]);
+  else if (argc < 3 || argc - 2 > NQUEUE || (strcmp(argv[1], "rt") == 0 && argc != 4))
+  {
+    printf(2, "usage: schedctl [boost q0 [q1 ...]] (up to %d levels)\n", NQUEUE);
+    printf(2, "       schedctl rt budget period\n");
+    printf(2, "       schedctl mlfq | stride\n");
+    printf(2, "       schedctl migration ms\n");
+    exit();
+  }
+  else if (strcmp(argv[1], "rt") == 0)
+  {
+    sp.rtbudget = atoi(argv[2]);
+    sp.rtperiod = atoi(argv[3]);
+  }
+  else
+  {
+    sp.nlevel = argc - 2;
+    sp.boostinterval = atoi(argv[1]);
+    for (i = 0; i < sp.nlevel; i++)
+      sp.quantum[i] = atoi(argv[i + 2]);
+  }
+  if (setschedparams(&sp) < 0)
+  {
+    printf(2, "schedctl: invalid parameters\n");
+    exit();
+  }
+
+  getschedparams(&sp);
+  printparams(&sp);
+  exit();
+}
@@ -0,0 +1,61 @@
+// project1 scheduler
+// prints the scheduling counters of processes and the wakeup latency histogram
+// usage : schedstat pid [pid ...]
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "sched.h"
+
+void printstats(int pid, struct procstats *ps)
+{
+  int i;
+
+  printf(1, "pid %d\n", pid);
+  printf(1, "\tms per level :");
+  for (i = 0; i < NQUEUE; i++)
+    printf(1, " %d", ps->leveltime[i]);
+  printf(1, "\n");
+  printf(1, "\tdemotions %d, boosts %d\n", ps->demotions, ps->boosts);
+  printf(1, "\tvoluntary yields %d, forced yields %d\n", ps->voluntary, ps->forced);
+  printf(1, "\twaited %d ms as RUNNABLE over %d runs\n", ps->waittime, ps->nwait);
+  printf(1, "\tmigrations %d\n", ps->migrations);
+}
+
+int main(int argc, char *argv[])
+{
+  struct schedstats st;
+  int i, pid, lo, hi;
+
+  if (argc < 2)
+  {
+    printf(2, "usage: schedstat pid [pid ...]\n");
+    exit();
+  }
+
+  for (i = 1; i < argc; i++)
+  {
+    pid = atoi(argv[i]);
+    if (getschedstats(pid, &st) < 0)
+    {
+      printf(2, "schedstat: no process %d\n", pid);
+      continue;
+    }
+    printstats(pid, &st.proc);
+  }
+
+  // st.latency is the same for every pid
+  if (getschedstats(getpid(), &st) < 0)
+    exit();
+  printf(1, "wakeup latency (ms)\n");
+  for (i = 0; i < NLATENCY; i++)
+  {
+    lo = i == 0 ? 0 : 1 << (i - 1);
+    hi = (1 << i) - 1;
+    if (i == NLATENCY - 1)
+      printf(1, "\t%d ~\t: %d\n", lo, st.latency[i]);
+    else
+      printf(1, "\t%d ~ %d\t: %d\n", lo, hi, st.latency[i]);
+  }
+  exit();
+}
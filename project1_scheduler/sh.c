@@ -52,6 +52,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+int plaincmd(char*);
 
 // Execute cmd.  Never returns.
 void
@@ -146,6 +147,7 @@ main(void)
 {
   static char buf[100];
   int fd;
+  struct execcmd *ecmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,6 +166,18 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(plaincmd(buf)){
+      // Start it from the file, the shell needs no copy.
+      ecmd = (struct execcmd*)parsecmd(buf);
+      if(ecmd->argv[0]){
+        if(spawn(ecmd->argv[0], ecmd->argv, 0) < 0)
+          printf(2, "exec %s failed\n", ecmd->argv[0]);
+        else
+          wait();
+      }
+      free(ecmd);
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait();
@@ -262,6 +276,22 @@ backcmd(struct cmd *subcmd)
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
 
+// Whether s is a single program with its arguments, which parsecmd
+// turns into an EXEC without any chance to panic.
+int
+plaincmd(char *s)
+{
+  int n = 0;
+
+  for(; *s; s++){
+    if(strchr(symbols, *s))
+      return 0;
+    if(!strchr(whitespace, *s) && (s[1] == 0 || strchr(whitespace, s[1])))
+      n++;
+  }
+  return n < MAXARGS;
+}
+
 int
 gettoken(char **ps, char *es, char **q, char **eq)
 {
@@ -0,0 +1,173 @@
+// Object caches for kernel structures smaller than a page.
+// A slab is a page from kalloc holding a struct slab and then as
+// many objects of its cache as fit; a free object holds a pointer
+// to the next free one of the slab. Full slabs are on no list, and
+// a cache keeps one slab with no objects in use instead of freeing
+// it at once. Objects too big to share a page get a page each.
+//
+// Each cpu keeps up to KCMAG freed objects of a cache and hands
+// them out again without the cache lock, moving KCMAG/2 of them
+// at once between its array and the slabs.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct slab *prev;
+  struct slab *next;
+  uint inuse;             // objects handed out
+  struct kobj *free;      // free objects
+};
+
+struct kobj {
+  struct kobj *next;
+};
+
+void
+kcacheinit(struct kcache *c, char *name, uint size)
+{
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  if(c->size < sizeof(struct kobj))
+    c->size = sizeof(struct kobj);
+  if(sizeof(struct slab) + c->size <= PGSIZE)
+    c->perslab = (PGSIZE - sizeof(struct slab)) / c->size;
+}
+
+static void
+pushslab(struct kcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+static void
+eraseslab(struct kcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Take an object from the slabs of c. Caller holds c->lock.
+static void*
+slaballoc(struct kcache *c)
+{
+  struct slab *s;
+  struct kobj *o;
+  char *p;
+  int i;
+
+  if(c->perslab == 0)
+    return kalloc();
+  if((s = c->partial) == 0){
+    if(c->empty){
+      s = c->empty;
+      c->empty = 0;
+    } else {
+      if((p = kalloc()) == 0)
+        return 0;
+      s = (struct slab*)p;
+      s->inuse = 0;
+      s->free = 0;
+      for(i = c->perslab - 1; i >= 0; i--){
+        o = (struct kobj*)(p + sizeof(struct slab) + i*c->size);
+        o->next = s->free;
+        s->free = o;
+      }
+    }
+    pushslab(c, s);
+  }
+  o = s->free;
+  s->free = o->next;
+  if(++s->inuse == c->perslab)
+    eraseslab(c, s);
+  return o;
+}
+
+// Give the object v back to its slab. Caller holds c->lock.
+static void
+slabfree(struct kcache *c, void *v)
+{
+  struct slab *s;
+  struct kobj *o = v;
+
+  if(c->perslab == 0){
+    kfree(v);
+    return;
+  }
+  s = (struct slab*)PGROUNDDOWN((uint)v);
+  if(s->inuse == c->perslab)
+    pushslab(c, s);
+  o->next = s->free;
+  s->free = o;
+  if(--s->inuse > 0)
+    return;
+  eraseslab(c, s);
+  if(c->empty == 0)
+    c->empty = s;
+  else
+    kfree((char*)s);
+}
+
+// Allocate an object of c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kcachealloc(struct kcache *c)
+{
+  void *v, **obj;
+  int *n;
+
+  pushcli();
+  obj = c->cpu[cpuid()].obj;
+  n = &c->cpu[cpuid()].n;
+  if(*n == 0){
+    acquire(&c->lock);
+    while(*n < KCMAG/2 && (v = slaballoc(c)) != 0)
+      obj[(*n)++] = v;
+    release(&c->lock);
+  }
+  v = *n ? obj[--*n] : 0;
+  popcli();
+  return v;
+}
+
+// Free the object v of c.
+void
+kcachefree(struct kcache *c, void *v)
+{
+  void **obj;
+  int i, *n;
+
+#ifdef DEBUG_KALLOC
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, c->size);
+#endif
+
+  pushcli();
+  obj = c->cpu[cpuid()].obj;
+  n = &c->cpu[cpuid()].n;
+  if(*n == KCMAG){
+    // give back the oldest half
+    acquire(&c->lock);
+    for(i = 0; i < KCMAG/2; i++)
+      slabfree(c, obj[i]);
+    release(&c->lock);
+    memmove(obj, obj + KCMAG/2, (KCMAG - KCMAG/2) * sizeof(obj[0]));
+    *n -= KCMAG/2;
+  }
+  obj[(*n)++] = v;
+  popcli();
+}
@@ -0,0 +1,19 @@
+// Caches of kernel objects of one size, see slab.c.
+// param.h and spinlock.h must be included before this file.
+
+#define KCMAG 16          // freed objects each cpu keeps
+
+struct slab;
+
+struct kcache {
+  struct spinlock lock;   // protects the slabs
+  char *name;
+  uint size;              // bytes of an object
+  uint perslab;           // objects in a slab, 0 if each gets its own page
+  struct slab *partial;   // slabs with free and used objects
+  struct slab *empty;     // one slab with all objects free, kept for reuse
+  struct {
+    void *obj[KCMAG];
+    int n;
+  } cpu[NCPU];            // objects of each cpu, under pushcli only
+};
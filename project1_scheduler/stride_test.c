@@ -0,0 +1,101 @@
+// project1 scheduler
+// measures how close the cpu shares of processes are to their ticket
+// shares under the stride scheduler, interval by interval.
+// shares are kept per cpu, so run it with make qemu CPUS=1
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "sched.h"
+
+#define NUM_CHILD 3
+#define NUM_ROUND 10
+#define INTERVAL 100 // 1 second, in sleep() ticks
+
+int tickets[NUM_CHILD] = {100, 200, 300};
+
+// ms the process has run
+uint runtime(int pid)
+{
+  struct schedstats st;
+  uint t = 0;
+  int i;
+
+  if (getschedstats(pid, &st) < 0)
+    return 0;
+  for (i = 0; i < NQUEUE; i++)
+    t += st.proc.leveltime[i];
+  return t;
+}
+
+int main(int argc, char *argv[])
+{
+  struct schedparams sp;
+  int pid[NUM_CHILD];
+  uint prev[NUM_CHILD], now[NUM_CHILD], total, share, expected, err, maxerr;
+  int i, round, policy, alltickets;
+
+  printf(1, "stride test start\n");
+
+  getschedparams(&sp);
+  policy = sp.policy;
+  sp.policy = SCHED_STRIDE;
+  if (setschedparams(&sp) < 0)
+  {
+    printf(1, "cannot select the stride scheduler\n");
+    exit();
+  }
+
+  alltickets = 0;
+  for (i = 0; i < NUM_CHILD; i++)
+  {
+    alltickets += tickets[i];
+    if ((pid[i] = fork()) == 0)
+    {
+      settickets(getpid(), tickets[i]);
+      for (;;)
+        ;
+    }
+  }
+
+  // let every child set its tickets and start spinning
+  sleep(INTERVAL / 10);
+  for (i = 0; i < NUM_CHILD; i++)
+    prev[i] = runtime(pid[i]);
+
+  // per mille
+  maxerr = 0;
+  for (round = 0; round < NUM_ROUND; round++)
+  {
+    sleep(INTERVAL);
+    total = 0;
+    for (i = 0; i < NUM_CHILD; i++)
+    {
+      now[i] = runtime(pid[i]);
+      total += now[i] - prev[i];
+    }
+    printf(1, "[round %d] %d ms :", round, total);
+    for (i = 0; i < NUM_CHILD; i++)
+    {
+      share = total ? (now[i] - prev[i]) * 1000 / total : 0;
+      expected = tickets[i] * 1000 / alltickets;
+      err = share > expected ? share - expected : expected - share;
+      if (err > maxerr)
+        maxerr = err;
+      printf(1, " %d.%d%% (%d.%d%%)", share / 10, share % 10, expected / 10, expected % 10);
+      prev[i] = now[i];
+    }
+    printf(1, "\n");
+  }
+  printf(1, "max share error %d.%d%%\n", maxerr / 10, maxerr % 10);
+
+  for (i = 0; i < NUM_CHILD; i++)
+    kill(pid[i]);
+  while (wait() != -1)
+    ;
+
+  sp.policy = policy;
+  setschedparams(&sp);
+  printf(1, "stride test done\n");
+  exit();
+}
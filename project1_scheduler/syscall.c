@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
@@ -21,6 +22,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(touchuvm(curproc->pgdir, addr, 4) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +42,9 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       touchuvm(curproc->pgdir, (uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -65,6 +71,8 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(touchuvm(curproc->pgdir, i, size) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -112,6 +120,12 @@ extern int sys_setPriority(void);
 extern int sys_schedulerLock(void);
 extern int sys_schedulerUnlock(void);
 extern int sys_setLevel(void);
+extern int sys_setschedparams(void);
+extern int sys_getschedparams(void);
+extern int sys_getschedstats(void);
+extern int sys_settickets(void);
+extern int sys_spawn(void);
+extern int sys_bigpages(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -144,6 +158,12 @@ static int (*syscalls[])(void) = {
 [SYS_schedulerLock]   sys_schedulerLock,
 [SYS_schedulerUnlock] sys_schedulerUnlock,
 [SYS_setLevel]        sys_setLevel,
+[SYS_setschedparams]  sys_setschedparams,
+[SYS_getschedparams]  sys_getschedparams,
+[SYS_getschedstats]   sys_getschedstats,
+[SYS_settickets]      sys_settickets,
+[SYS_spawn]           sys_spawn,
+[SYS_bigpages]        sys_bigpages,
 };
 
 void
@@ -26,4 +26,10 @@
 #define SYS_setPriority     25
 #define SYS_schedulerLock   26
 #define SYS_schedulerUnlock 27
-#define SYS_setLevel        28
\ No newline at end of file
+#define SYS_setLevel        28
+#define SYS_setschedparams  29
+#define SYS_getschedparams  30
+#define SYS_getschedstats   31
+#define SYS_settickets      32
+#define SYS_spawn           33
+#define SYS_bigpages        34
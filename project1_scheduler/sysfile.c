@@ -9,9 +9,9 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "fs.h"
-#include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
@@ -419,6 +419,45 @@ sys_exec(void)
   return exec(path, argv);
 }
 
+// Like exec, but in a new child process: spawn(path, argv, fdmap)
+// where fdmap is 0 or holds NOFILE descriptors of the caller.
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG], *umap;
+  int i, fdmap[NOFILE], *map;
+  uint uargv, uarg, ufdmap;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 || argint(2, (int*)&ufdmap) < 0){
+    return -1;
+  }
+  // spawn() gets a checked copy: the user one can change under it
+  map = 0;
+  if(ufdmap){
+    if(argptr(2, &umap, sizeof(fdmap)) < 0)
+      return -1;
+    memmove(fdmap, umap, sizeof(fdmap));
+    for(i = 0; i < NOFILE; i++)
+      if(fdmap[i] < -1 || fdmap[i] >= NOFILE)
+        return -1;
+    map = fdmap;
+  }
+  memset(argv, 0, sizeof(argv));
+  for(i=0;; i++){
+    if(i >= NELEM(argv))
+      return -1;
+    if(fetchint(uargv+4*i, (int*)&uarg) < 0)
+      return -1;
+    if(uarg == 0){
+      argv[i] = 0;
+      break;
+    }
+    if(fetchstr(uarg, &argv[i]) < 0)
+      return -1;
+  }
+  return spawn(path, argv, map);
+}
+
 int
 sys_pipe(void)
 {
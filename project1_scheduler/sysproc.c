@@ -5,6 +5,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 
 int
@@ -56,6 +57,20 @@ sys_sbrk(void)
   return addr;
 }
 
+// bigpages(1) makes later sbrk() growth map each aligned 4 MiB block
+// it covers with one large page; the setting is kept across exec and
+// inherited by children
+int
+sys_bigpages(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  myproc()->bigpages = on != 0;
+  return 0;
+}
+
 int
 sys_sleep(void)
 {
@@ -64,6 +79,8 @@ sys_sleep(void)
 
   if(argint(0, &n) < 0)
     return -1;
+  // n is in 1/USERHZ seconds, whatever HZ is
+  n = (n * HZ + USERHZ - 1) / USERHZ;
   acquire(&tickslock);
   ticks0 = ticks;
   while(ticks - ticks0 < n){
@@ -87,7 +104,8 @@ sys_uptime(void)
   acquire(&tickslock);
   xticks = ticks;
   release(&tickslock);
-  return xticks;
+  // in 1/USERHZ seconds, whatever HZ is
+  return xticks / HZ * USERHZ + xticks % HZ * USERHZ / HZ;
 }
 
 // project1 scheduler
@@ -96,7 +114,7 @@ sys_uptime(void)
 // TODO : modify wrapper function exceptions and return value
 int sys_yield(void)
 {
-  yield();
+  yield(1);
   return 0;
 }
 
@@ -140,4 +158,38 @@ int sys_setLevel(void)
     return -1;
   setLevel(pid, level);
   return 0;
-}
\ No newline at end of file
+}
+
+int sys_setschedparams(void)
+{
+  struct schedparams *sp;
+  if (argptr(0, (void*)&sp, sizeof(*sp)) < 0)
+    return -1;
+  return setschedparams(sp);
+}
+
+int sys_getschedparams(void)
+{
+  struct schedparams *sp;
+  if (argptr(0, (void*)&sp, sizeof(*sp)) < 0)
+    return -1;
+  getschedparams(sp);
+  return 0;
+}
+
+int sys_getschedstats(void)
+{
+  int pid;
+  struct schedstats *st;
+  if (argint(0, &pid) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  return getschedstats(pid, st);
+}
+
+int sys_settickets(void)
+{
+  int pid, tickets;
+  if (argint(0, &pid) < 0 || argint(1, &tickets) < 0)
+    return -1;
+  return settickets(pid, tickets);
+}
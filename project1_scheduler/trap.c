@@ -3,10 +3,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
-#include "spinlock.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -68,7 +68,16 @@ trap(struct trapframe *tf)
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
+      // project1 scheduler
+      schedulerTick();
     }
+    rtTick();
+    lapiceoi();
+    break;
+  // project1 scheduler
+  // wakes up the cpu from hlt in scheduler(), or preempts the running
+  // process for a real-time one
+  case T_IRQ0 + IRQ_RESCHED:
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -93,6 +102,15 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // heap pages are mapped on first touch (see growproc) and pages
+    // shared by fork copied on the first write. system calls fault in
+    // their user buffers with touchuvm() before using them, so a bad
+    // buffer or no memory fails the call rather than getting here
+    if(myproc() && rcr2() < myproc()->sz &&
+       faultuvm(myproc()->pgdir, rcr2()) >= 0)
+      break;
+    // fall through
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -117,9 +135,12 @@ trap(struct trapframe *tf)
 
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
+  // project1 scheduler: a real-time process keeps running until it
+  // blocks or its cpu runs out of real-time budget
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
-    yield();
+     (tf->trapno == T_IRQ0+IRQ_TIMER || tf->trapno == T_IRQ0+IRQ_RESCHED) &&
+     (!myproc()->rt || mycpu()->rtthrottled))
+    yield(0);
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
@@ -34,6 +34,7 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_RESCHED     24      // project1 scheduler: IPI to wake up an idle cpu
 #define IRQ_SPURIOUS    31
 
 // lab4 practice
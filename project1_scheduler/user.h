@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct schedparams;
+struct schedstats;
 
 // system calls
 int fork(void);
@@ -11,6 +13,7 @@ int read(int, void*, int);
 int close(int);
 int kill(int);
 int exec(char*, char**);
+int spawn(char*, char**, int*);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -21,6 +24,7 @@ int chdir(const char*);
 int dup(int);
 int getpid(void);
 char* sbrk(int);
+int bigpages(int);
 int sleep(int);
 int uptime(void);
 // lab4 system call practice
@@ -32,6 +36,10 @@ void setPriority(int, int);
 void schedulerLock(int);
 void schedulerUnlock(int);
 void setLevel(int, int);
+int setschedparams(struct schedparams*);
+int getschedparams(struct schedparams*);
+int getschedstats(int, struct schedstats*);
+int settickets(int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -4,6 +4,7 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "elf.h"
 
@@ -39,6 +40,10 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  // A large page has no page table: nothing is found and nothing
+  // can be added under it until splituvm() gives it one.
+  if(*pde & PTE_PS)
+    return 0;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
@@ -79,6 +84,35 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Like mappages(), but the parts of the range aligned to BIGPGSIZE
+// get large pages, which need no page table. For the kernel part of
+// a page table, which walkpgdir() never splits.
+static int
+mapbigpages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  uint a, n;
+
+  a = (uint)va;
+  while(size > 0){
+    if(a % BIGPGSIZE == 0 && pa % BIGPGSIZE == 0 && size >= BIGPGSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS;
+      n = BIGPGSIZE;
+    } else {
+      n = BIGPGSIZE - a % BIGPGSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, (void*)a, n, pa, perm) < 0)
+        return -1;
+    }
+    a += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -127,8 +161,8 @@ setupkvm(void)
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
+    if(mapbigpages(pgdir, k->virt, k->phys_end - k->phys_start,
+                   (uint)k->phys_start, k->perm) < 0) {
       freevm(pgdir);
       return 0;
     }
@@ -248,21 +282,90 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Map a zeroed large page at each BIGPGSIZE-aligned block that lies
+// within oldsz to newsz and has no page table yet; the rest is left
+// to be mapped on first touch. The pages of a block are allocated
+// together but freed one by one.
+void
+allocbiguvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  char *mem;
+  uint a;
+  int i;
+
+  for(a = (oldsz + BIGPGSIZE - 1) & ~(BIGPGSIZE - 1);
+      a + BIGPGSIZE <= newsz && a + BIGPGSIZE > a; a += BIGPGSIZE){
+    if(pgdir[PDX(a)] != 0)
+      continue;
+    if((mem = kalloc_order(BIGPGORDER)) == 0)
+      return;
+    memset(mem, 0, BIGPGSIZE);
+    for(i = 1; i < NPTENTRIES; i++)
+      kref(mem + i*PGSIZE);
+    pgdir[PDX(a)] = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+  }
+}
+
+// Give the large user page of pde a page table with the same
+// mappings, whose PTEs keep its flags. Returns -1 if there is no
+// memory for the page table.
+static int
+splitpde(pde_t *pde)
+{
+  pte_t *pgtab;
+  int i;
+
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (PTE_ADDR(*pde) + i*PGSIZE) | (PTE_FLAGS(*pde) & ~PTE_PS);
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
+// Split the large page holding va into a page table, unless va is
+// on its boundary, so the pages below and above va can be unmapped
+// apart. Returns -1 if there is no memory for the page table.
+static int
+splituvm(pde_t *pgdir, uint va)
+{
+  if(va % BIGPGSIZE == 0 || va >= KERNBASE || !(pgdir[PDX(va)] & PTE_PS))
+    return 0;
+  return splitpde(&pgdir[PDX(va)]);
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or 0 with nothing
+// freed if there is no memory to split a large page.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  pde_t *pde;
   pte_t *pte;
   uint a, pa;
+  int i;
 
   if(newsz >= oldsz)
     return oldsz;
+  // large pages across either end get page tables first, so running
+  // out of memory for one leaves every page mapped
+  if(splituvm(pgdir, PGROUNDUP(newsz)) < 0 || splituvm(pgdir, oldsz) < 0)
+    return 0;
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    pde = &pgdir[PDX(a)];
+    if((*pde & PTE_PS) && a % BIGPGSIZE == 0 && a + BIGPGSIZE <= oldsz){
+      // a whole large page, each of its pages is freed on its own
+      pa = PTE_ADDR(*pde);
+      *pde = 0;
+      for(i = 0; i < NPTENTRIES; i++)
+        kfree(P2V(pa + i*PGSIZE));
+      a += BIGPGSIZE - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -289,7 +392,7 @@ freevm(pde_t *pgdir)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+    if((pgdir[i] & PTE_P) && !(pgdir[i] & PTE_PS)){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -297,6 +400,27 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
+// Map a zeroed page at va if nothing is there yet. Returns -1 if va
+// is already mapped or there is no memory.
+int
+demanduvm(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(pgdir, (char*)va, 0)) != 0 && *pte != 0)
+    return -1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
 // Clear PTE_U on a page. Used to create an inaccessible
 // page beneath the user stack.
 void
@@ -311,31 +435,48 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The pages are shared, read-only and
+// copy-on-write in both, so the caller must flush the tlb
+// of the parent.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
-  pde_t *d;
+  pde_t *d, *pde;
   pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  uint pa, i, j, flags;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    pde = &pgdir[PDX(i)];
+    if(*pde & PTE_PS){
+      // a large page is shared whole, counted before it goes
+      // read-only like the small ones below
+      if(*pde & PTE_P){
+        pa = PTE_ADDR(*pde);
+        for(j = 0; j < NPTENTRIES; j++)
+          kref(P2V(pa + j*PGSIZE));
+        if(*pde & PTE_W)
+          *pde = (*pde & ~PTE_W) | PTE_COW;
+        d[PDX(i)] = *pde;
+      }
+      i += BIGPGSIZE - PGSIZE;
+      continue;
+    }
+    // heap pages not touched yet stay unmapped in the child
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
     pa = PTE_ADDR(*pte);
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
-    }
+    kref(P2V(pa));
   }
   return d;
 
@@ -344,15 +485,122 @@ bad:
   return 0;
 }
 
+// Give the page table its own writable copy of the copy-on-write
+// page of pte at va. Returns 1 if the page was copied, 0 if nobody
+// shared it any more, -1 if there is no memory.
+static int
+cowuvm(pte_t *pte, uint va)
+{
+  uint pa = PTE_ADDR(*pte);
+  char *mem;
+
+  if(krefs(P2V(pa)) == 1){
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+    invlpg((void*)va);
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, P2V(pa), PGSIZE);
+  *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  kfree(P2V(pa));
+  invlpg((void*)va);
+  return 1;
+}
+
+// Make the copy-on-write large page of pde at va writable if none of
+// its pages is shared any more. Returns -1 if some still is.
+static int
+bigcowuvm(pde_t *pde, uint va)
+{
+  uint pa = PTE_ADDR(*pde);
+  int i;
+
+  for(i = 0; i < NPTENTRIES; i++)
+    if(krefs(P2V(pa + i*PGSIZE)) != 1)
+      return -1;
+  *pde = (*pde & ~PTE_COW) | PTE_W;
+  invlpg((void*)va);
+  return 0;
+}
+
+// Handle a page fault at the user address va, below the process
+// size: map a zeroed page where nothing is mapped yet, or copy a
+// copy-on-write page. Returns 0 if va can be accessed now, 1 if a
+// shared page was copied, -1 if the access is bad.
+int
+faultuvm(pde_t *pgdir, uint va)
+{
+  pde_t *pde;
+  pte_t *pte;
+
+  va = PGROUNDDOWN(va);
+  pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS){
+    if((*pde & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+      return -1;
+    if(bigcowuvm(pde, va) == 0)
+      return 0;
+    // still shared after a fork: copied page by page from here on
+    if(splitpde(pde) < 0)
+      return -1;
+  }
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte == 0 || *pte == 0)
+    return demanduvm(pgdir, va);
+  if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+    return -1;
+  if(*pte & PTE_COW)
+    return cowuvm(pte, va);
+  return -1;
+}
+
+// Whether the kernel can read and write the user page at va without
+// a fault.
+static int
+readyuvm(pde_t *pgdir, uint va)
+{
+  pde_t *pde;
+  pte_t *pte;
+
+  pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return (*pde & (PTE_P|PTE_U|PTE_COW)) == (PTE_P|PTE_U);
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  return pte && (*pte & (PTE_P|PTE_U|PTE_COW)) == (PTE_P|PTE_U);
+}
+
+// Fault in the user pages from va up to va+n, below the process
+// size, that the kernel could not use yet. A fault in the kernel
+// cannot fail the system call, so argptr() and friends call this
+// first. Returns 0, or -1 if a page is bad or there is no memory.
+int
+touchuvm(pde_t *pgdir, uint va, uint n)
+{
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+    if(!readyuvm(pgdir, a) && faultuvm(pgdir, a) < 0)
+      return -1;
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
+  pde_t pde;
   pte_t *pte;
 
+  pde = pgdir[PDX(uva)];
+  if(pde & PTE_PS){
+    if((pde & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+      return 0;
+    return (char*)P2V(PTE_ADDR(pde) + PGROUNDDOWN((uint)uva % BIGPGSIZE));
+  }
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -371,6 +619,11 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // the write goes through the kernel mapping, which ignores PTE_W,
+    // so a mapped page that is not writable yet is copied first
+    if(!readyuvm(pgdir, va0) && uva2ka(pgdir, (char*)va0) &&
+       faultuvm(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
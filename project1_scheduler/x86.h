@@ -117,6 +117,15 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one.
+// sti takes effect after the next instruction,
+// so an interrupt cannot slip in before hlt.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -130,6 +139,33 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Index of the lowest set bit of val. val must not be 0.
+static inline uint
+bsf(uint val)
+{
+  uint idx;
+
+  asm volatile("bsfl %1, %0" : "=r" (idx) : "rm" (val) : "cc");
+  return idx;
+}
+
+// Low 32 bits of the time stamp counter.
+// Enough to measure intervals shorter than 2^32 cycles.
+static inline uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
+static inline void
+invlpg(void *addr)
+{
+  asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
 static inline uint
 rcr2(void)
 {
@@ -0,0 +1,94 @@
+// Tests fork while sibling threads write to the memory being shared
+// copy-on-write: the child must keep the memory as it was at fork
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NUM_THREAD 4
+#define NPAGE 16
+#define NFORK 50
+#define PGSIZE 4096
+
+char region[NPAGE * PGSIZE];
+char snapshot[NPAGE * PGSIZE];
+volatile int stop;
+
+void*
+writermain(void *arg)
+{
+  int tid = (int)arg;
+  int i, n = 0;
+  while (!stop){
+    // every write to a page shared by the last fork faults
+    for (i = 0; i < NPAGE; i++)
+      ((volatile int*)region)[(i * PGSIZE) / 4 + tid] = ++n;
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// in the child: the pages must not change under it
+void
+checkchild(int fd)
+{
+  int i;
+  char ok = 1;
+
+  memmove(snapshot, region, sizeof(region));
+  sleep(1);
+  for (i = 0; i < sizeof(region); i++)
+    if (region[i] != snapshot[i])
+      ok = 0;
+  write(fd, &ok, 1);
+  exit();
+}
+
+int
+cowforktest(void)
+{
+  thread_t threads[NUM_THREAD];
+  void *retval;
+  int i, pid, fds[2], ret = 0;
+  char ok;
+
+  stop = 0;
+  for (i = 0; i < NUM_THREAD; i++)
+    if (thread_create(&threads[i], writermain, (void*)i) != 0)
+      return -1;
+  for (i = 0; i < NFORK && ret == 0; i++){
+    if (pipe(fds) < 0){
+      ret = -1;
+      break;
+    }
+    if ((pid = fork()) < 0){
+      close(fds[0]);
+      close(fds[1]);
+      ret = -1;
+      break;
+    }
+    if (pid == 0){
+      close(fds[0]);
+      checkchild(fds[1]);
+    }
+    close(fds[1]);
+    if (read(fds[0], &ok, 1) != 1 || !ok){
+      printf(1, "fork %d: child memory changed\n", i);
+      ret = -1;
+    }
+    close(fds[0]);
+    wait();
+  }
+  stop = 1;
+  for (i = 0; i < NUM_THREAD; i++)
+    if (thread_join(threads[i], &retval) != 0)
+      ret = -1;
+  return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "cowforktest %s\n", cowforktest() == 0 ? "ok" : "failed");
+  exit();
+}
@@ -1,11 +1,13 @@
 struct buf;
 struct context;
 struct file;
+struct kcache;
 struct inode;
 struct pipe;
 struct proc;
 struct thread;
 struct rtcdate;
+struct meminfo;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -25,6 +27,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             loadimage(struct thread*, char*, char**, int);
 int             exec2(char*, char**, int);
 
 // file.c
@@ -67,6 +70,15 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kallocfor(struct proc*);
+void            kref(char*);
+int             krefs(char*);
+char*           kalloc_order(int);
+void            kfree_order(char*, int);
+void            kallocdump(void);
+void            kresetproc(struct proc*);
+struct proc*    kchargeto(struct proc*);
+void            kmeminfo(struct proc*, struct meminfo*);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
@@ -81,6 +93,7 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(uchar, int);
 void            microdelay(int);
 
 // log.c
@@ -98,20 +111,33 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
+// slab.c
+void            kcacheinit(struct kcache*, char*, uint);
+void*           kcachealloc(struct kcache*);
+void            kcachefree(struct kcache*, void*);
+
 //PAGEBREAK: 16
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             spawn(char*, char**, int*);
 int             growproc(int);
 int             kill(int);
+int             killed(void);
+int             pagefault(uint);
+int             touchmem(uint, uint);
+void            lockmem(struct proc*);
+void            unlockmem(struct proc*);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
+struct thread*  mythread(void);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -126,15 +152,19 @@ struct proc     *getProc(int pid);
 int             setmemorylimit(int pid, int limit);
 void            printProc(struct proc*);
 int             printProcList(void);
-int             thidxtorun(struct proc*);
-int             copythproc(struct proc*, int);
-int             existrunnable(struct proc*);
-int             copyprocth(struct proc*, int);
+int             meminfo(int, struct meminfo*);
+int             procslot(struct proc*);
+int             cachehot(struct thread*, struct cpu*);
+void            runthread(struct cpu*, struct thread*);
 int             allocth(struct proc*);
+struct thread*  allocthread(struct proc*);
+void            clearthreads(struct thread*);
 int             countth(struct proc*);
 int             thread_create(thread_t*, void*(void*), void*);
 void            thread_exit(void*);
 int             thread_join(thread_t, void**);
+int             futex_wait(int*, int);
+int             futex_wake(int*, int);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -191,15 +221,24 @@ void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
+void            allocbiguvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+int             unmapuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
-void            switchuvm(struct proc*);
+void            switchuvm(struct thread*);
 void            switchkvm(void);
+void            tlbshootdown(struct proc*);
+void            tlbflushintr(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             guarduvm(pde_t*, uint, uint);
+void            unguarduvm(pde_t*, uint, uint);
+int             demanduvm(pde_t*, uint);
+int             faultuvm(pde_t*, uint);
+int             readyuvm(pde_t*, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -7,8 +7,13 @@
 #include "x86.h"
 #include "elf.h"
 
+// Load the program at path with arguments argv and a user stack of
+// stacksize pages into a new page table for the process of th. Once
+// nothing can fail any more, the process is switched over to it with
+// th as its only thread, set to start the program; the old page table
+// is left to the caller. Returns -1 if the process is unchanged.
 int
-exec(char *path, char **argv)
+loadimage(struct thread *th, char *path, char **argv, int stacksize)
 {
   char *s, *last;
   int i, off;
@@ -16,30 +21,18 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  pde_t *pgdir;
+  struct proc *p = th->proc;
+  struct proc *chargeto;
   char* pustack;
 
-  for (int i = 0; i < NTHREAD; ++i) {
-    if (i == curproc->thidx) continue;
-    curproc->freedustack[i] = 0;
-    struct thread* th = curproc->thread + i;
-    th->tid = 0;
-    if (th->kstack)
-      kfree(th->kstack);
-    th->kstack = 0;
-    th->state = UNUSED;
-    th->tf = 0;
-    th->context = 0;
-    th->chan = 0;
-    th->retval = 0;
-    th->ustack = 0;
-  }
-
+  // the image is p's, also when spawn() builds it for a new process
+  chargeto = kchargeto(p);
   begin_op();
 
   if((ip = namei(path)) == 0){
     end_op();
+    kchargeto(chargeto);
     cprintf("exec: fail\n");
     return -1;
   }
@@ -77,12 +70,12 @@ exec(char *path, char **argv)
   end_op();
   ip = 0;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
+  // Allocate 1 + stacksize pages at the next page boundary.
+  // Make the first inaccessible.  Use the rest as the user stack.
   sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
+  if((sz = allocuvm(pgdir, sz, sz + (1 + stacksize) * PGSIZE)) == 0)
     goto bad;
-  clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
+  clearpteu(pgdir, (char*)(sz - (1 + stacksize) * PGSIZE));
   sp = sz;
   pustack = (char*)sp;
 
@@ -109,19 +102,17 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  curproc->stacksize = 1;
-  curproc->ustack = pustack;
-  curproc->thread[curproc->thidx].state = RUNNING;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  p->pgdir = pgdir;
+  p->sz = sz;
+  th->tf->eip = elf.entry;  // main
+  th->tf->esp = sp;
+  p->stacksize = stacksize;
+  th->ustack = pustack;
+  p->nustackpool = 0;
+  kchargeto(chargeto);
   return 0;
 
  bad:
@@ -131,13 +122,24 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  kchargeto(chargeto);
   return -1;
 }
 
 
+int
+exec(char *path, char **argv)
+{
+  return exec2(path, argv, 1);
+}
+
 int
 exec2(char *path, char **argv, int stacksize)
 {
+  struct thread *curth = mythread();
+  struct proc *curproc = curth->proc;
+  pde_t *oldpgdir;
+
   if (stacksize < 1) {
     stacksize = 1;
     cprintf("[WARN] in exec2 function, stacksize less than 1, allocating 1 page\n");
@@ -146,126 +148,13 @@ exec2(char *path, char **argv, int stacksize)
     stacksize = 100;
     cprintf("[WARN] in exec2 function, stacksize greater than 100, allocating 100 pages\n");
   }
-  char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
-  struct elfhdr elf;
-  struct inode *ip;
-  struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
-  char* pustack;
-
-  for (int i = 0; i < NTHREAD; ++i) {
-    if (i == curproc->thidx) continue;
-    curproc->freedustack[i] = 0;
-    struct thread* th = curproc->thread + i;
-    th->tid = 0;
-    if (th->kstack)
-      kfree(th->kstack);
-    th->kstack = 0;
-    th->state = UNUSED;
-    th->tf = 0;
-    th->context = 0;
-    th->chan = 0;
-    th->retval = 0;
-    th->ustack = 0;
-  }
-
-  begin_op();
-
-  if((ip = namei(path)) == 0){
-    end_op();
-    cprintf("exec: fail\n");
-    return -1;
-  }
-  ilock(ip);
-  pgdir = 0;
-
-  // Check ELF header
-  if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
-    goto bad;
-  if(elf.magic != ELF_MAGIC)
-    goto bad;
-
-  if((pgdir = setupkvm()) == 0)
-    goto bad;
-
-  // Load program into memory.
-  sz = 0;
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
-      continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;
-  }
-  iunlockput(ip);
-  end_op();
-  ip = 0;
-
-  // Allocate 1 + stacksize pages at the next page boundary.
-  // Make the first inaccessible.  Use the rest as the user stack.
-  sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + (1 + stacksize) * PGSIZE)) == 0)
-    goto bad;
-  clearpteu(pgdir, (char*)(sz - (1 + stacksize) * PGSIZE));
-  sp = sz;
-  pustack = (char*)sp;
-
-  // Push argument strings, prepare rest of stack in ustack.
-  for(argc = 0; argv[argc]; argc++) {
-    if(argc >= MAXARG)
-      goto bad;
-    sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
-    if(copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
-      goto bad;
-    ustack[3+argc] = sp;
-  }
-  ustack[3+argc] = 0;
-
-  ustack[0] = 0xffffffff;  // fake return PC
-  ustack[1] = argc;
-  ustack[2] = sp - (argc+1)*4;  // argv pointer
 
-  sp -= (3+argc+1) * 4;
-  if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
-    goto bad;
+  clearthreads(curth);
 
-  // Save program name for debugging.
-  for(last=s=path; *s; s++)
-    if(*s == '/')
-      last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
-
-  // Commit to the user image.
   oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  curproc->stacksize = stacksize;
-  curproc->ustack = pustack;
-  curproc->thread[curproc->thidx].state = RUNNING;
-  switchuvm(curproc);
+  if(loadimage(curth, path, argv, stacksize) < 0)
+    return -1;
+  switchuvm(curth);
   freevm(oldpgdir);
   return 0;
-
- bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
-    end_op();
-  }
-  return -1;
 }
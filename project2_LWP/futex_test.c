@@ -0,0 +1,156 @@
+// Tests the mutex, condition variable and barrier of ulib.c
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NUM_THREAD 8
+#define NLOOP 100000
+#define NITEM 1000
+
+mutex_t lock;
+cond_t notempty, notfull;
+barrier_t barrier;
+volatile int gcnt;
+int buf[4], nbuf, head;
+int phases[NUM_THREAD];
+
+void*
+countmain(void *arg)
+{
+  int i;
+  for (i = 0; i < NLOOP; i++){
+    mutex_lock(&lock);
+    gcnt++;
+    mutex_unlock(&lock);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+int
+mutextest(void)
+{
+  thread_t threads[NUM_THREAD];
+  void *retval;
+  int i;
+
+  mutex_init(&lock);
+  gcnt = 0;
+  for (i = 0; i < NUM_THREAD; i++)
+    if (thread_create(&threads[i], countmain, 0) != 0)
+      return -1;
+  for (i = 0; i < NUM_THREAD; i++)
+    if (thread_join(threads[i], &retval) != 0)
+      return -1;
+  if (gcnt != NUM_THREAD * NLOOP){
+    printf(1, "gcnt %d, expected %d\n", gcnt, NUM_THREAD * NLOOP);
+    return -1;
+  }
+  return 0;
+}
+
+void*
+producermain(void *arg)
+{
+  int i;
+  for (i = 1; i <= NITEM; i++){
+    mutex_lock(&lock);
+    while (nbuf == 4)
+      cond_wait(&notfull, &lock);
+    buf[(head + nbuf++) % 4] = i;
+    cond_signal(&notempty);
+    mutex_unlock(&lock);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void*
+consumermain(void *arg)
+{
+  int i, sum = 0;
+  for (i = 0; i < NITEM; i++){
+    mutex_lock(&lock);
+    while (nbuf == 0)
+      cond_wait(&notempty, &lock);
+    sum += buf[head];
+    head = (head + 1) % 4;
+    nbuf--;
+    cond_signal(&notfull);
+    mutex_unlock(&lock);
+  }
+  thread_exit((void*)sum);
+  return 0;
+}
+
+int
+condtest(void)
+{
+  thread_t producer, consumer;
+  void *retval;
+
+  mutex_init(&lock);
+  cond_init(&notempty);
+  cond_init(&notfull);
+  nbuf = head = 0;
+  if (thread_create(&consumer, consumermain, 0) != 0 ||
+      thread_create(&producer, producermain, 0) != 0)
+    return -1;
+  if (thread_join(producer, &retval) != 0)
+    return -1;
+  if (thread_join(consumer, &retval) != 0)
+    return -1;
+  if ((int)retval != NITEM * (NITEM + 1) / 2){
+    printf(1, "sum %d, expected %d\n", (int)retval, NITEM * (NITEM + 1) / 2);
+    return -1;
+  }
+  return 0;
+}
+
+void*
+barriermain(void *arg)
+{
+  int tid = (int)arg;
+  int i, j;
+  for (i = 0; i < 10; i++){
+    phases[tid] = i;
+    barrier_wait(&barrier);
+    // nobody is ahead of or behind this phase
+    for (j = 0; j < NUM_THREAD; j++)
+      if (phases[j] != i)
+        thread_exit((void*)-1);
+    barrier_wait(&barrier);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+int
+barriertest(void)
+{
+  thread_t threads[NUM_THREAD];
+  void *retval;
+  int i, ret = 0;
+
+  barrier_init(&barrier, NUM_THREAD);
+  for (i = 0; i < NUM_THREAD; i++)
+    if (thread_create(&threads[i], barriermain, (void*)i) != 0)
+      return -1;
+  for (i = 0; i < NUM_THREAD; i++){
+    if (thread_join(threads[i], &retval) != 0)
+      return -1;
+    if (retval != 0)
+      ret = -1;
+  }
+  return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "mutextest %s\n", mutextest() == 0 ? "ok" : "failed");
+  printf(1, "condtest %s\n", condtest() == 0 ? "ok" : "failed");
+  printf(1, "barriertest %s\n", barriertest() == 0 ? "ok" : "failed");
+  exit();
+}
@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and blocks of
+// 2^n physically contiguous pages with kalloc_order().
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +9,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "meminfo.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -15,12 +18,44 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;   // on the lists of kmem.free only
+};
+
+// Free memory is kept by a buddy allocator: a free block of order k
+// is 2^k pages starting at a page number that is a multiple of 2^k,
+// and is merged with its buddy, the other half of the block of order
+// k+1, as soon as both are free.
+//
+// Free pages kept by each cpu, so that most calls do not take
+// kmem.lock. A magazine that runs empty or full moves KBATCH
+// pages from or to the buddy lists at once.
+#define KMAG   32
+#define KBATCH (KMAG/2)
+
+struct magazine {
+  struct run *list;
+  int n;
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[KMAXORDER+1];  // free blocks of each order
+  uint nblock[KMAXORDER+1];       // length of each of those lists
+  struct magazine mag[NCPU];
+  uchar ref[PHYSTOP/PGSIZE];  // mappings of each page, for copy-on-write
+  uchar order[PHYSTOP/PGSIZE];  // 1 + order of a free block at each page
+  // Each allocated page is charged to the process it is for (see
+  // chargee), by its slot in the process table. A new process in the
+  // slot gets a new generation, so pages of the old one no longer
+  // count. Pages can outlive their process by far (copy-on-write ones
+  // kept by a child), so the generation must not wrap in practice.
+  uchar owner[PHYSTOP/PGSIZE];    // 1 + slot, 0 if allocated by no process
+  uint ownergen[PHYSTOP/PGSIZE];  // generation of the slot when charged
+  uint gen[NPROC];
+  int procpages[NPROC];
+  int npages;
+  int nfree;
 } kmem;
 
 // Initialization happens in two phases.
@@ -36,6 +71,8 @@ kinit1(void *vstart, void *vend)
   freerange(vstart, vend);
 }
 
+// The magazines are only used once the other cpus run, with
+// kmem.use_lock set, as cpuid() needs mpinit().
 void
 kinit2(void *vstart, void *vend)
 {
@@ -48,32 +85,178 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p) / PGSIZE] = 1;
+    kmem.owner[V2P(p) / PGSIZE] = 0;
+    kmem.npages++;
     kfree(p);
+  }
+}
+
+// The process the pages allocated now are for: the one the running
+// thread set with kchargeto(), else its own.
+static struct proc*
+chargee(void)
+{
+  struct thread *th;
+
+  if(!kmem.use_lock || (th = mythread()) == 0)
+    return 0;
+  return th->chargeto ? th->chargeto : th->proc;
+}
+
+// Charge the n pages from physical page number pn, just allocated,
+// to p, or to no process if p is 0. Each page is charged on its own,
+// as the pages of a large user page are freed one by one.
+static void
+charge(uint pn, int n, struct proc *p)
+{
+  int i, slot;
+
+  slot = p ? procslot(p) : -1;
+  for(i = 0; i < n; i++){
+    kmem.owner[pn + i] = slot + 1;
+    if(p)
+      kmem.ownergen[pn + i] = kmem.gen[slot];
+  }
+  if(p)
+    __sync_add_and_fetch(&kmem.procpages[slot], n);
+  __sync_sub_and_fetch(&kmem.nfree, n);
+}
+
+// Give back the charge of the n pages from physical page number pn,
+// freed.
+static void
+uncharge(uint pn, int n)
+{
+  int i, slot;
+
+  for(i = 0; i < n; i++){
+    slot = kmem.owner[pn + i] - 1;
+    if(slot >= 0 && kmem.ownergen[pn + i] == kmem.gen[slot])
+      __sync_sub_and_fetch(&kmem.procpages[slot], 1);
+  }
+  __sync_add_and_fetch(&kmem.nfree, n);
+}
+
+static void
+pushblock(struct run *r, int k)
+{
+  r->prev = 0;
+  r->next = kmem.free[k];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[k] = r;
+  kmem.nblock[k]++;
+  kmem.order[V2P(r) / PGSIZE] = k + 1;
+}
+
+static void
+eraseblock(struct run *r, int k)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nblock[k]--;
+  kmem.order[V2P(r) / PGSIZE] = 0;
+}
+
+// Take a free block of order k, splitting a larger one if there is
+// none. Caller holds kmem.lock, if use_lock.
+static struct run*
+buddyalloc(int k)
+{
+  struct run *r;
+  int j;
+
+  for(j = k; j <= KMAXORDER && kmem.free[j] == 0; j++)
+    ;
+  if(j > KMAXORDER)
+    return 0;
+  r = kmem.free[j];
+  eraseblock(r, j);
+  // the upper halves stay free
+  while(j > k){
+    j--;
+    pushblock((struct run*)((char*)r + (PGSIZE << j)), j);
+  }
+  return r;
 }
+
+// Free the block of order k at r, merged with its free buddies.
+// Caller holds kmem.lock, if use_lock.
+static void
+buddyfree(struct run *r, int k)
+{
+  uint pn, bn;
+
+  pn = V2P(r) / PGSIZE;
+  for(; k < KMAXORDER; k++){
+    bn = pn ^ (1 << k);
+    if(bn >= PHYSTOP/PGSIZE || kmem.order[bn] != k + 1)
+      break;
+    eraseblock((struct run*)P2V(bn * PGSIZE), k);
+    pn &= ~(1 << k);
+  }
+  pushblock((struct run*)P2V(pn * PGSIZE), k);
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// A page shared copy-on-write is only freed by its last user.
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *s;
+  struct magazine *m;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  if(kmem.ref[V2P(v) / PGSIZE] == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(&kmem.ref[V2P(v) / PGSIZE], 1) != 0)
+    return;
+  uncharge(V2P(v) / PGSIZE, 1);
 
+#ifdef DEBUG_KALLOC
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    buddyfree(r, 0);
+    return;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  if(m->n == KMAG){
+    // give back the oldest half, the newest pages are still cached
+    for(i = 0, s = m->list; i < KMAG-KBATCH-1; i++)
+      s = s->next;
+    r = s->next;
+    s->next = 0;
+    acquire(&kmem.lock);
+    for(; r; r = s){
+      s = r->next;
+      buddyfree(r, 0);
+    }
     release(&kmem.lock);
+    m->n -= KBATCH;
+    r = (struct run*)v;
+  }
+  r->next = m->list;
+  m->list = r;
+  m->n++;
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -81,23 +264,167 @@ kfree(char *v)
 // Returns 0 if the memory cannot be allocated.
 char*
 kalloc(void)
+{
+  return kallocfor(chargee());
+}
+
+// kalloc(), charging the page to p, or to no process if p is 0, as
+// for pages that back a cache shared by all processes.
+char*
+kallocfor(struct proc *p)
 {
   struct run *r;
+  struct magazine *m;
 
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    r = buddyalloc(0);
+    if(r){
+      kmem.ref[V2P(r) / PGSIZE] = 1;
+      charge(V2P(r) / PGSIZE, 1, p);
+    }
+    return (char*)r;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  if(m->n == 0){
+    // Up to KBATCH pages; pages in the magazines of other cpus
+    // stay there, at most NCPU*KMAG of them.
     acquire(&kmem.lock);
-  r = kmem.freelist;
+    while(m->n < KBATCH && (r = buddyalloc(0)) != 0){
+      r->next = m->list;
+      m->list = r;
+      m->n++;
+    }
+    release(&kmem.lock);
+  }
+  r = m->list;
+  if(r){
+    m->list = r->next;
+    m->n--;
+    kmem.ref[V2P(r) / PGSIZE] = 1;
+  }
+  popcli();
   if(r)
-    kmem.freelist = r->next;
+    charge(V2P(r) / PGSIZE, 1, p);
+  return (char*)r;
+}
+
+// Count one more mapping of the allocated page v.
+void
+kref(char *v)
+{
+  __sync_add_and_fetch(&kmem.ref[V2P(v) / PGSIZE], 1);
+}
+
+// Number of mappings of the allocated page v.
+int
+krefs(char *v)
+{
+  return kmem.ref[V2P(v) / PGSIZE];
+}
+
+// Charge the pages the running thread allocates from now on to p,
+// which it is setting up, or to its own process again if p is 0.
+// Returns the previous setting, to put back.
+struct proc*
+kchargeto(struct proc *p)
+{
+  struct thread *th = mythread();
+  struct proc *old;
+
+  if(th == 0)
+    return 0;
+  old = th->chargeto;
+  th->chargeto = p;
+  return old;
+}
+
+// Start counting the pages of the new process p from zero.
+// Called before p allocates anything.
+void
+kresetproc(struct proc *p)
+{
+  int slot = procslot(p);
+
+  kmem.gen[slot]++;
+  kmem.procpages[slot] = 0;
+}
+
+// Fill in mi with the page counters, and those of p if not 0.
+void
+kmeminfo(struct proc *p, struct meminfo *mi)
+{
+  int k;
+
+  mi->total = kmem.npages;
+  mi->free = kmem.nfree;
+  mi->used = mi->total - mi->free;
+  mi->procpages = p ? kmem.procpages[procslot(p)] : 0;
+  for(k = 0; k <= KMAXORDER; k++)
+    mi->nblock[k] = kmem.nblock[k];
+}
+
+// Allocate a block of 2^n physically contiguous pages, aligned to
+// its size. Returns 0 if there is no free block that large; pages
+// kept by the cpus for kalloc() do not count.
+char*
+kalloc_order(int n)
+{
+  struct run *r;
+
+  if(n < 0 || n > KMAXORDER)
+    return 0;
+  if(n == 0)
+    return kalloc();
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  r = buddyalloc(n);
   if(kmem.use_lock)
     release(&kmem.lock);
+  if(r){
+    kmem.ref[V2P(r) / PGSIZE] = 1;
+    charge(V2P(r) / PGSIZE, 1 << n, chargee());
+  }
   return (char*)r;
 }
 
-int frees() {
-  int cnt = 0;
-  for (struct run* r = kmem.freelist; r; r = r->next) {
-    cnt++;
+// Free the block of 2^n pages at v from kalloc_order(n).
+void
+kfree_order(char *v, int n)
+{
+  if(n == 0){
+    kfree(v);
+    return;
   }
-  return cnt;
-}
\ No newline at end of file
+  if(n < 0 || n > KMAXORDER || V2P(v) % (PGSIZE << n) || v < end ||
+     V2P(v) + (PGSIZE << n) > PHYSTOP)
+    panic("kfree_order");
+  if(kmem.ref[V2P(v) / PGSIZE] != 1)
+    panic("kfree_order: not allocated");
+  kmem.ref[V2P(v) / PGSIZE] = 0;
+  uncharge(V2P(v) / PGSIZE, 1 << n);
+
+#ifdef DEBUG_KALLOC
+  memset(v, 1, PGSIZE << n);
+#endif
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  buddyfree((struct run*)v, n);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Print the free blocks of each order, to see how fragmented free
+// memory is: many small blocks cannot serve a large kalloc_order().
+void
+kallocdump(void)
+{
+  int k;
+
+  cprintf("free blocks by order:");
+  for(k = 0; k <= KMAXORDER; k++)
+    cprintf(" %d", kmem.nblock[k]);
+  cprintf("\n");
+}
@@ -0,0 +1,10 @@
+// page counters returned by meminfo, shared with user programs
+// param.h must be included before this file
+
+struct meminfo {
+  uint total;                 // pages kalloc manages
+  uint free;                  // pages free
+  uint used;                  // total - free
+  uint procpages;             // pages allocated for the process and still in use
+  uint nblock[KMAXORDER+1];   // free blocks of 2^k pages (see kalloc.c)
+};
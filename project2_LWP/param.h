@@ -10,5 +10,9 @@
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       2000  // size of file system in blocks, mkfs lays out fs.img by it
+#define KMAXORDER    10  // largest kalloc_order() block is 2^KMAXORDER pages
+#define NSLEEPQ      64  // wait queues of sleep/wakeup, power of 2
 #define NTHREAD      64
+#define LAZYSTACK     1  // map thread stack pages but the top one on first touch
+#define MIGRATIONCOST 1  // ticks a process stays cache hot after running
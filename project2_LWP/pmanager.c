@@ -1,6 +1,8 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "param.h"
+#include "meminfo.h"
 
 #define BUFFER_SIZE 128
 
@@ -29,12 +31,13 @@ int strncmp(char* s1, char* s2, int cnt) {
 int
 main(int argc, char *argv[])
 {
-  enum itype { LIST, KILL, EXECUTE, MEMLIM, EXIT, itypeCount};
+  enum itype { LIST, KILL, EXECUTE, MEMLIM, MEMINFO, EXIT, itypeCount};
   char* instructions[] = {
     [LIST]    "list",
     [KILL]    "kill",
     [EXECUTE] "execute",
     [MEMLIM]  "memlim",
+    [MEMINFO] "meminfo",
     [EXIT]    "exit"
   };
   char buffer[BUFFER_SIZE];
@@ -102,6 +105,21 @@ main(int argc, char *argv[])
         printf(1, "memlim success\n");
       }
     }
+    else if (curIns == MEMINFO) {
+      struct meminfo mi;
+      token = strtok(0, ' ');
+      if (meminfo(atoi(token), &mi)) {
+        printf(1, "meminfo failure\n");
+      }
+      else {
+        printf(1, "total %d free %d used %d process %d pages\n", mi.total, mi.free, mi.used, mi.procpages);
+        printf(1, "free blocks by order:");
+        for (int i = 0; i <= KMAXORDER; ++i) {
+          printf(1, " %d", mi.nblock[i]);
+        }
+        printf(1, "\n");
+      }
+    }
     else if (curIns == EXIT) {
       exit();
     }
@@ -6,27 +6,42 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "meminfo.h"
 #define PRINTFL() cprintf("%s %d\n", __FUNCTION__, __LINE__)
-#define NEXTTH(i) (((i) + 1) % NTHREAD)
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct thread *sleepq[NSLEEPQ];   // sleeping threads hashed by chan
+  struct thread *runq;              // fifo of RUNNABLE threads
+  struct thread *runqtail;
 } ptable;
 
 static struct proc *initproc;
 
+// protects the futex words between the check and the sleep
+struct spinlock futexlock;
+
 int nextpid = 1;
 int nexttid = 1;
 extern void forkret(void);
 extern void trapret(void);
-extern int frees(void);
 
 static void wakeup1(void *chan);
+static void erasesleep(struct thread *th);
+static void makerunnable(struct thread *th);
+static void eraserunq(struct thread *th);
+static void freeth(struct thread *th);
+static void stopsiblings(struct thread *cur);
+static void putustack(struct proc *p, uint top, int shootdown);
+
+// ticks after running that a thread is left to the cpu it ran on
+int migrationcost = MIGRATIONCOST;
 
 void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  initlock(&futexlock, "futex");
 }
 
 // Must be called with interrupts disabled
@@ -56,69 +71,64 @@ mycpu(void)
 }
 
 // Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
-struct proc*
-myproc(void) {
+// while reading thread from the cpu structure
+struct thread*
+mythread(void) {
   struct cpu *c;
-  struct proc *p;
+  struct thread *th;
   pushcli();
   c = mycpu();
-  p = c->proc;
+  th = c->thread;
   popcli();
-  return p;
+  return th;
+}
+
+// The process of the running thread
+struct proc*
+myproc(void) {
+  struct thread *th = mythread();
+  return th ? th->proc : 0;
+}
+
+// Index of p in the process table.
+int
+procslot(struct proc *p)
+{
+  return p - ptable.proc;
 }
 
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
-// state required to run in the kernel.
+// its first thread to run in the kernel.
 // Otherwise return 0.
-static struct proc*
+static struct thread*
 allocproc(void)
 {
   struct proc *p;
-  char *sp;
-  int thidx;
+  struct thread *th;
 
   acquire(&ptable.lock);
 
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED) {
-      thidx = allocth(p);
+    if(p->state == UNUSED)
       goto found;
-    }
   release(&ptable.lock);
   return 0;
 
 found:
+  kresetproc(p);
+  if((th = allocthread(p)) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
   p->state = EMBRYO;
   p->pid = nextpid++;
   p->limit = 0;
+  p->bigpages = 0;
   release(&ptable.lock);
 
-  // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
-    p->thread[thidx].state = UNUSED;
-    return 0;
-  }
-  sp = p->kstack + KSTACKSIZE;
-
-  // Leave room for trap frame.
-  sp -= sizeof *p->tf;
-  p->tf = (struct trapframe*)sp;
-
-  // Set up new context to start executing at forkret,
-  // which returns to trapret.
-  sp -= 4;
-  *(uint*)sp = (uint)trapret;
-
-  sp -= sizeof *p->context;
-  p->context = (struct context*)sp;
-  memset(p->context, 0, sizeof *p->context);
-  p->context->eip = (uint)forkret;
-
-  return p;
+  return th;
 }
 
 //PAGEBREAK: 32
@@ -127,23 +137,25 @@ void
 userinit(void)
 {
   struct proc *p;
+  struct thread *th;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
-  p = allocproc();
-  
+  th = allocproc();
+  p = th->proc;
+
   initproc = p;
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
-  memset(p->tf, 0, sizeof(*p->tf));
-  p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
-  p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
-  p->tf->es = p->tf->ds;
-  p->tf->ss = p->tf->ds;
-  p->tf->eflags = FL_IF;
-  p->tf->esp = PGSIZE;
-  p->tf->eip = 0;  // beginning of initcode.S
+  memset(th->tf, 0, sizeof(*th->tf));
+  th->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  th->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  th->tf->es = th->tf->ds;
+  th->tf->ss = th->tf->ds;
+  th->tf->eflags = FL_IF;
+  th->tf->esp = PGSIZE;
+  th->tf->eip = 0;  // beginning of initcode.S
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
@@ -155,14 +167,14 @@ userinit(void)
   acquire(&ptable.lock);
 
   p->state = RUNNABLE;
-  p->thread[p->thidx].state = RUNNABLE;
-  copyprocth(p, p->thidx);
-  
+  makerunnable(th);
+
   release(&ptable.lock);
 }
 
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
+// The caller must hold the memory lock of the process (see lockmem).
 int
 growproc(int n)
 {
@@ -176,14 +188,30 @@ growproc(int n)
     newsz = curproc->limit;
   }
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, newsz)) == 0)
+    // the pages are mapped on first touch, see pagefault()
+    if(newsz >= KERNBASE)
       return -1;
+    if(curproc->bigpages)
+      allocbiguvm(curproc->pgdir, sz, newsz);
+    sz = newsz;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // under ptable.lock, so a sibling thread cannot fault a page of
+    // the range back in before it is freed; sibling threads on other
+    // cpus may still cache the pages, so they are flushed first
+    acquire(&ptable.lock);
+    if(unmapuvm(curproc->pgdir, sz, sz + n) < 0){
+      release(&ptable.lock);
+      return -1;
+    }
+    curproc->sz = sz + n;
+    tlbshootdown(curproc);
+    sz = deallocuvm(curproc->pgdir, sz, sz + n);
+    release(&ptable.lock);
+    if(sz == 0)
       return -1;
   }
   curproc->sz = sz;
-  switchuvm(curproc);
+  switchuvm(mythread());
   return 0;
 }
 
@@ -195,27 +223,51 @@ fork(void)
 {
   int i, pid;
   struct proc *np;
-  struct proc *curproc = myproc();
+  struct thread *nt;
+  struct thread *curth = mythread();
+  struct proc *curproc = curth->proc;
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((nt = allocproc()) == 0){
     return -1;
   }
+  np = nt->proc;
 
-  // Copy process state from proc.
+  // Copy process state from proc. The page tables are the child's.
+  lockmem(curproc);
+  kchargeto(np);
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
+    kchargeto(0);
+    unlockmem(curproc);
+    acquire(&ptable.lock);
+    freeth(nt);
     np->state = UNUSED;
-    np->thread[np->thidx].state = UNUSED;
+    release(&ptable.lock);
     return -1;
   }
   np->sz = curproc->sz;
+  np->stacksize = curproc->stacksize;
+
+  // Only the calling thread is copied. The stacks of the others are
+  // unmapped in the child and go to its pool with the free ones.
+  np->nustackpool = curproc->nustackpool;
+  for (i = 0; i < curproc->nustackpool; ++i)
+    np->ustackpool[i] = curproc->ustackpool[i];
+  for (i = 0; i < NTHREAD; ++i) {
+    struct thread* th = curproc->thread + i;
+    if (th != curth && th->state != UNUSED && th->ustack)
+      putustack(np, (uint)th->ustack, 0);
+  }
+  kchargeto(0);
+  nt->ustack = curth->ustack;
+  // the pages of the parent went read-only
+  tlbshootdown(curproc);
+  unlockmem(curproc);
   np->parent = curproc;
-  *np->tf = *curproc->tf;
+  *nt->tf = *curth->tf;
 
   // Clear %eax so that fork returns 0 in the child.
-  np->tf->eax = 0;
+  nt->tf->eax = 0;
 
   for(i = 0; i < NOFILE; i++)
     if(curproc->ofile[i])
@@ -225,24 +277,74 @@ fork(void)
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
   np->limit = curproc->limit;
-  np->stacksize = curproc->stacksize;
+  np->bigpages = curproc->bigpages;
 
-  for (int i = 0; i < NTHREAD; ++i) {
-    np->freedustack[i] = curproc->freedustack[i];
-    if (curproc->freedustack[i] == 0) {
-      np->freedustack[i] = curproc->thread[i].ustack;
-    }
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->state = RUNNABLE;
+  makerunnable(nt);
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Create a process running the program at path with arguments argv,
+// without copying the caller first as fork() and exec() would, nor
+// its other threads and their stacks. File descriptor i of the new
+// process is a dup of the caller's fdmap[i], or closed if that is -1;
+// with no fdmap it gets all of the caller's descriptors, as in fork().
+// fdmap is kernel memory holding only -1 or descriptor numbers.
+// Returns the pid of the new process.
+int
+spawn(char *path, char **argv, int *fdmap)
+{
+  int i, fd, pid;
+  struct proc *np;
+  struct thread *nt;
+  struct thread *curth = mythread();
+  struct proc *curproc = curth->proc;
+
+  if(fdmap)
+    for(i = 0; i < NOFILE; i++)
+      if(fdmap[i] != -1 && curproc->ofile[fdmap[i]] == 0)
+        return -1;
+
+  // Allocate process.
+  if((nt = allocproc()) == 0){
+    return -1;
   }
-  np->freedustack[np->thidx] = 0;
-  np->thread[np->thidx].ustack = curproc->thread[curproc->thidx].ustack;
+  np = nt->proc;
+
+  // The segments and flags of a user trapframe; loadimage sets the rest.
+  *nt->tf = *curth->tf;
+  if(loadimage(nt, path, argv, 1) < 0){
+    acquire(&ptable.lock);
+    freeth(nt);
+    np->state = UNUSED;
+    release(&ptable.lock);
+    return -1;
+  }
+  np->parent = curproc;
+
+  for(i = 0; i < NOFILE; i++){
+    fd = fdmap ? fdmap[i] : i;
+    if(fd >= 0 && curproc->ofile[fd])
+      np->ofile[i] = filedup(curproc->ofile[fd]);
+  }
+  np->cwd = idup(curproc->cwd);
+
+  np->limit = curproc->limit;
+  np->bigpages = curproc->bigpages;
 
   pid = np->pid;
 
   acquire(&ptable.lock);
 
   np->state = RUNNABLE;
-  np->thread[np->thidx].state = RUNNABLE;
-  copyprocth(np, np->thidx);
+  makerunnable(nt);
 
   release(&ptable.lock);
 
@@ -255,13 +357,26 @@ fork(void)
 void
 exit(void)
 {
-  struct proc *curproc = myproc();
+  struct thread *curth = mythread();
+  struct proc *curproc = curth->proc;
   struct proc *p;
   int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
+  acquire(&ptable.lock);
+  if(curproc->exiter && curproc->exiter != curth){
+    // Another thread is taking the process down; only this thread ends.
+    curth->state = ZOMBIE;
+    wakeup1(curproc->exiter);
+    sched();
+    panic("zombie exit");
+  }
+  // The other threads may still use the files and the address space.
+  stopsiblings(curth);
+  release(&ptable.lock);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -288,11 +403,14 @@ exit(void)
         wakeup1(initproc);
     }
   }
+
+  // The other threads are stopped, wait() frees them all.
+  curth->state = ZOMBIE;
   curproc->state = ZOMBIE;
 
-  // Jump into the scheduler, never to return if shouldexit is true.
+  // Jump into the scheduler, never to return.
   sched();
-  if (p->state == ZOMBIE) panic("zombie exit");
+  panic("zombie exit");
 }
 
 // Wait for a child process to exit and return its pid.
@@ -315,7 +433,6 @@ wait(void)
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        p->kstack = 0;
         freevm(p->pgdir);
         p->pid = 0;
         p->parent = 0;
@@ -323,23 +440,15 @@ wait(void)
         p->killed = 0;
         p->state = UNUSED;
         p->limit = 0;
-        p->ustack = 0;
+        p->memlock = 0;
+        p->exiter = 0;
 
+        p->nustackpool = 0;
         for (int i = 0; i < NTHREAD; ++i) {
           struct thread* th = p->thread + i;
-          p->freedustack[i] = 0;
-
-          if (th->state == UNUSED)
-            continue;
-
-          th->tid = 0;
-          if (th->kstack)
-            kfree(th->kstack);
-          th->kstack = 0;
-          th->state = UNUSED;
-          th->tf = 0;
-          th->context = 0;
-          th->chan = 0;
+          th->ustack = 0;
+          if (th->state != UNUSED)
+            freeth(th);
         }
 
         release(&ptable.lock);
@@ -348,7 +457,7 @@ wait(void)
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || curproc->killed){
+    if(!havekids || killed()){
       release(&ptable.lock);
       return -1;
     }
@@ -359,75 +468,93 @@ wait(void)
 }
 
 //PAGEBREAK: 42
-// Per-CPU process scheduler.
+// Per-CPU thread scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
-//  - swtch to start running that process
-//  - eventually that process transfers control
+//  - choose a thread to run from the run queue
+//  - swtch to start running that thread
+//  - eventually that thread transfers control
 //      via swtch back to the scheduler.
 void
 scheduler(void)
 {
-  struct proc *p;
+  struct thread *th, *hot;
   struct cpu *c = mycpu();
-  c->proc = 0;
+  c->thread = 0;
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
-    // Loop over process table looking for process to run.
+    // Take the first thread in the run queue that can run here.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE || !existrunnable(p))
+    hot = 0;
+    for(th = ptable.runq; th; th = th->runnext){
+      // a thread whose cache state is still on another cpu is left to
+      // that cpu, unless this cpu has nothing else to run
+      if(cachehot(th, c)){
+        if(hot == 0)
+          hot = th;
         continue;
-      int thidx = thidxtorun(p);
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      copythproc(p, thidx);
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-      p->thread[thidx].state = RUNNING;
-      swtch(&(c->scheduler), p->context);
-      switchkvm();
-
-      copyprocth(p, thidx);
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
+      }
+      break;
     }
+    if(th == 0)
+      th = hot;
+    if(th)
+      runthread(c, th);
     release(&ptable.lock);
   }
 }
 
+// true if th ran on a cpu other than c less than migrationcost ticks ago
+int cachehot(struct thread* th, struct cpu* c) {
+  return th->lastcpu && th->lastcpu != c && ticks - th->lastrun < migrationcost;
+}
+
+// runs th on c until it gives up the cpu
+// ptable.lock must be held
+void runthread(struct cpu* c, struct thread* th) {
+  // Switch to chosen thread.  It is the thread's job
+  // to release ptable.lock and then reacquire it
+  // before jumping back to us.
+  eraserunq(th);
+  c->thread = th;
+  switchuvm(th);
+  th->state = RUNNING;
+  swtch(&(c->scheduler), th->context);
+  switchkvm();
+
+  th->lastcpu = c;
+  th->lastrun = ticks;
+
+  // Thread is done running for now.
+  // It should have changed its th->state before coming back.
+  c->thread = 0;
+}
+
 // Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state. Saves and restores
+// and have changed thread->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
-// be proc->intena and proc->ncli, but that would
+// be thread->intena and thread->ncli, but that would
 // break in the few places where a lock is held but
-// there's no process.
+// there's no thread.
 void
 sched(void)
 {
   int intena;
-  struct proc *p = myproc();
+  struct thread *th = mythread();
 
   if(!holding(&ptable.lock))
     panic("sched ptable.lock");
   if(mycpu()->ncli != 1)
     panic("sched locks");
-  if(p->state == RUNNING)
+  if(th->state == RUNNING)
     panic("sched running");
   if(readeflags()&FL_IF)
     panic("sched interruptible");
   intena = mycpu()->intena;
-  copythproc(p, p->thidx);
-  swtch(&p->context, mycpu()->scheduler);
-  copyprocth(p, p->thidx);
+  swtch(&th->context, mycpu()->scheduler);
   mycpu()->intena = intena;
 }
 
@@ -436,8 +563,7 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
-  myproc()->thread[myproc()->thidx].state = RUNNABLE;
+  makerunnable(mythread());
   sched();
   release(&ptable.lock);
 }
@@ -463,14 +589,87 @@ forkret(void)
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// Wait queue of the sleepers on chan, shared by the channels with the
+// same hash.
+static struct thread**
+sleepqueue(void *chan)
+{
+  uint h = (uint)chan >> 2;
+
+  return &ptable.sleepq[(h ^ (h >> 7) ^ (h >> 14)) & (NSLEEPQ - 1)];
+}
+
+// The ptable lock must be held.
+static void
+pushsleep(struct thread *th)
+{
+  struct thread **q = sleepqueue(th->chan);
+
+  th->sleepprev = 0;
+  th->sleepnext = *q;
+  if(*q)
+    (*q)->sleepprev = th;
+  *q = th;
+}
+
+// The ptable lock must be held.
+static void
+erasesleep(struct thread *th)
+{
+  if(th->sleepprev)
+    th->sleepprev->sleepnext = th->sleepnext;
+  else
+    *sleepqueue(th->chan) = th->sleepnext;
+  if(th->sleepnext)
+    th->sleepnext->sleepprev = th->sleepprev;
+  th->sleepprev = th->sleepnext = 0;
+}
+
+// The ptable lock must be held.
+static void
+pushrunq(struct thread *th)
+{
+  th->runnext = 0;
+  th->runprev = ptable.runqtail;
+  if(ptable.runqtail)
+    ptable.runqtail->runnext = th;
+  else
+    ptable.runq = th;
+  ptable.runqtail = th;
+}
+
+// The ptable lock must be held.
+static void
+eraserunq(struct thread *th)
+{
+  if(th->runprev)
+    th->runprev->runnext = th->runnext;
+  else
+    ptable.runq = th->runnext;
+  if(th->runnext)
+    th->runnext->runprev = th->runprev;
+  else
+    ptable.runqtail = th->runprev;
+  th->runprev = th->runnext = 0;
+}
+
+// Marks th RUNNABLE and queues it for the scheduler.
+// The ptable lock must be held.
+static void
+makerunnable(struct thread *th)
+{
+  th->state = RUNNABLE;
+  pushrunq(th);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
-  struct proc *p = myproc();
+  struct thread *th = mythread();
   
-  if(p == 0)
+  if(th == 0)
     panic("sleep");
 
   if(lk == 0)
@@ -482,15 +681,16 @@ sleep(void *chan, struct spinlock *lk)
   // guaranteed that we won't miss any wakeup
   // (wakeup runs with ptable.lock locked),
   // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
+  if(lk != &ptable.lock)  //DOC: sleeplock0
     acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
   // Go to sleep.
-  struct thread* th = p->thread + p->thidx;
+  // Queued before lk is released, so a wakeup(chan) called with lk
+  // held either finds this thread or comes before the sleep.
   th->chan = chan;
+  pushsleep(th);
+  if(lk != &ptable.lock)
+    release(lk);
   th->state = SLEEPING;
-  p->state = RUNNABLE;
 
   sched();
 
@@ -505,33 +705,65 @@ sleep(void *chan, struct spinlock *lk)
 }
 
 //PAGEBREAK!
-// Wake up all processes sleeping on chan.
+// Wake up all threads sleeping on chan.
 // The ptable lock must be held.
+// Only walks the wait queue of chan. exit() takes the threads of an
+// exited process out of it.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-  struct thread* th;
+  struct thread *th, *next;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if (p->state != RUNNABLE && p->state != RUNNING) continue;
-    for (int i = 0; i < NTHREAD; ++i) {
-      th = p->thread + i;
-      if(th->state == SLEEPING && th->chan == chan)
-        th->state = RUNNABLE;
+  for(th = *sleepqueue(chan); th; th = next){
+    next = th->sleepnext;
+    if(th->chan == chan){
+      erasesleep(th);
+      makerunnable(th);
     }
   }
 }
 
 // Wake up all threads sleeping on chan.
+// Every caller holds the lock the sleepers passed to sleep(), and a
+// sleeper is queued before it releases that lock, so an empty wait
+// queue means there is no one to wake and ptable.lock is not taken.
 void
 wakeup(void *chan)
 {
+  if(*sleepqueue(chan) == 0)
+    return;
   acquire(&ptable.lock);
   wakeup1(chan);
   release(&ptable.lock);
 }
 
+// Wake up at most n threads of p sleeping on chan, the ones that
+// slept first. Returns how many were woken.
+// As wakeup(), the caller holds the lock the sleepers passed to sleep().
+static int
+wakeupn(void *chan, struct proc *p, int n)
+{
+  struct thread *th, *prev;
+  int woken = 0;
+
+  if(*sleepqueue(chan) == 0)
+    return 0;
+  acquire(&ptable.lock);
+  // sleepers are pushed at the front, start from the back
+  for(th = *sleepqueue(chan); th && th->sleepnext; th = th->sleepnext)
+    ;
+  for(; th && woken < n; th = prev){
+    prev = th->sleepprev;
+    if(th->chan == chan && th->proc == p){
+      erasesleep(th);
+      makerunnable(th);
+      woken++;
+    }
+  }
+  release(&ptable.lock);
+  return woken;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -544,10 +776,13 @@ kill(int pid)
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->pid == pid){
       p->killed = 1;
-      struct thread* th = p->thread + p->thidx;
-      // Wake process from sleep if necessary.
-      if(th->state == SLEEPING)
-        th->state = RUNNABLE;
+      // Wake its threads from sleep if necessary.
+      for(struct thread *th = p->thread; th < &p->thread[NTHREAD]; th++){
+        if(th->state == SLEEPING){
+          erasesleep(th);
+          makerunnable(th);
+        }
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -556,6 +791,94 @@ kill(int pid)
   return -1;
 }
 
+// Maps a zeroed page at va if it is a page of the process left to be
+// mapped on first touch: heap grown by sbrk, or a thread stack. sz
+// never exceeds p->limit, so neither do these. A write to a page
+// still shared with a fork parent or child gets its own copy.
+// Returns 0 if done, -1 if the access is bad.
+int
+pagefault(uint va)
+{
+  struct proc *p = myproc();
+  int r;
+
+  // serializes with other threads faulting on the page, with
+  // thread_create mapping stacks and with the memory being shrunk or
+  // a stack freed, which hold ptable.lock from unmapping to freeing
+  acquire(&ptable.lock);
+  r = va < p->sz ? faultuvm(p->pgdir, va) : -1;
+  release(&ptable.lock);
+  // the other threads may still see the shared page
+  if(r > 0)
+    tlbshootdown(p);
+  return r < 0 ? -1 : 0;
+}
+
+// Faults in the user pages from va up to va+n that the kernel could
+// not use yet (see readyuvm), so a bad or unbacked page fails the
+// system call instead of faulting in the kernel. Returns 0, or -1 if
+// a page is out of the process, a guard page or a freed stack, or
+// there is no memory for it.
+int
+touchmem(uint va, uint n)
+{
+  struct proc *p = myproc();
+  uint a;
+  int r, copied;
+
+  if(va >= p->sz || va + n > p->sz || va + n < va)
+    return -1;
+  copied = 0;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    // the usual case, which needs no lock
+    if(readyuvm(p->pgdir, a))
+      continue;
+    // sz is checked again under the lock, see pagefault()
+    acquire(&ptable.lock);
+    r = a < p->sz ? faultuvm(p->pgdir, a) : -1;
+    release(&ptable.lock);
+    if(r < 0)
+      break;
+    if(r > 0)
+      copied = 1;
+  }
+  // the other threads may still see the shared pages
+  if(copied)
+    tlbshootdown(p);
+  return a < va + n ? -1 : 0;
+}
+
+// Whether the current thread has to leave the kernel: its process
+// was killed, or another thread of it is in exit() or exec().
+int
+killed(void)
+{
+  struct thread *th = mythread();
+  struct proc *p = th->proc;
+
+  return p->killed || (p->exiter && p->exiter != th);
+}
+
+// Serializes the threads of p that change its size or page table.
+void
+lockmem(struct proc *p)
+{
+  acquire(&ptable.lock);
+  while(p->memlock)
+    sleep(&p->memlock, &ptable.lock);
+  p->memlock = 1;
+  release(&ptable.lock);
+}
+
+void
+unlockmem(struct proc *p)
+{
+  acquire(&ptable.lock);
+  p->memlock = 0;
+  wakeup1(&p->memlock);
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -573,6 +896,7 @@ procdump(void)
   };
   int i;
   struct proc *p;
+  struct thread *th;
   char *state;
   uint pc[10];
 
@@ -583,20 +907,20 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d[%d] %s %s %p %p %p", p->pid, p->thidx, state, p->name, p->kstack, p->tf, p->context);
-    if(p->state == SLEEPING){
-      getcallerpcs((uint*)p->context->ebp+2, pc);
-      for(i=0; i<10 && pc[i] != 0; i++)
-        cprintf(" %p", pc[i]);
-    }
-    cprintf("\n");
-    for (int i = 0; i < NTHREAD; ++i) {
-      struct thread* th = p->thread + i;
-      state = states[th->state];
-      if (th->state != UNUSED) 
-        cprintf("- [%d] %d %s %p %p %p\n", i, th->tid, state, th->kstack, th->tf, th->context);
+    cprintf("%d %s %s\n", p->pid, state, p->name);
+    for(th = p->thread; th < &p->thread[NTHREAD]; th++){
+      if(th->state == UNUSED)
+        continue;
+      cprintf("- [%d] %d %s %p %p %p", (int)(th - p->thread), th->tid, states[th->state], th->kstack, th->tf, th->context);
+      if(th->state == SLEEPING){
+        getcallerpcs((uint*)th->context->ebp+2, pc);
+        for(i=0; i<10 && pc[i] != 0; i++)
+          cprintf(" %p", pc[i]);
+      }
+      cprintf("\n");
     }
   }
+  kallocdump();
 }
 
 struct proc *getProc(int pid)
@@ -639,14 +963,18 @@ void printProc(struct proc* p) {
   [RUNNING]   "RUNNING ",
   [ZOMBIE]    "ZOMBIE  "
   };
-  cprintf("[ %d ]\t%s\t%d\t%d\t%d\t%d\t%s\n", p->pid, (p->state < 6 && p->state >= 0) ? states[p->state] : "???     ", countth(p), p->stacksize, p->sz, p->limit, p->name);
+  struct meminfo mi;
+  kmeminfo(p, &mi);
+  cprintf("[ %d ]\t%s\t%d\t%d\t%d\t%d\t%d\t%s\n", p->pid, (p->state < 6 && p->state >= 0) ? states[p->state] : "???     ", countth(p), p->stacksize, p->sz, p->limit, mi.procpages, p->name);
 }
 
 int printProcList() {
   struct proc* p;
-  cprintf("total free pages: %d\n", frees());
+  struct meminfo mi;
+  kmeminfo(0, &mi);
+  cprintf("total free pages: %d\n", mi.free);
   acquire(&ptable.lock);
-  cprintf("[pid]\t [state] \t[runth]\t[stack]\t[size]\t[limit]\t[name]\n");
+  cprintf("[pid]\t [state] \t[runth]\t[stack]\t[size]\t[limit]\t[pages]\t[name]\n");
   cprintf("--------------------------------------------------\n");
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if (p->state != UNUSED) {
@@ -658,44 +986,21 @@ int printProcList() {
   return 0;
 }
 
-// returns a thread index to run 
-// implementation of RR scheduler of thread
-int thidxtorun(struct proc* p) {
-  int previdx = p->thidx;
-  for (int i = NEXTTH(previdx); i != previdx; i = NEXTTH(i)) {
-    struct thread* th = p->thread + i;
-    if (th->state == RUNNABLE) return i;
-  }
-  return previdx;
-}
-
-// copies from thread to process (except ustack and state)
-int copythproc(struct proc* p, int thidx) {
-  struct thread* th = p->thread + thidx;
-  p->kstack = th->kstack;
-  p->tf = th->tf;
-  p->context = th->context;
-  p->chan = th->chan;
-  p->thidx = thidx;
-  return 0;
-}
-
-// returns if there is a RUNNABLE thread in a process
-int existrunnable(struct proc* p) {
-  for (int i = 0; i < NTHREAD; ++i) {
-    if (p->thread[i].state == RUNNABLE) return 1;
+// fills in mi with the page counters of the process pid, or of the
+// current process if pid is 0
+// returns -1 if there is no such process
+int meminfo(int pid, struct meminfo* mi) {
+  struct proc* p;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if (p->state != UNUSED && (pid == 0 ? p == myproc() : p->pid == pid)) {
+      kmeminfo(p, mi);
+      release(&ptable.lock);
+      return 0;
+    }
   }
-  return 0;
-}
-
-// copies from proc to thread (except ustack and state)
-int copyprocth(struct proc* p, int thidx) {
-  struct thread* th = p->thread + thidx;
-  th->kstack = p->kstack;
-  th->tf = p->tf;
-  th->context = p->context;
-  th->chan = p->chan;
-  return 0;
+  release(&ptable.lock);
+  return -1;
 }
 
 // allocates thread in process and returns the index
@@ -723,75 +1028,198 @@ int countth(struct proc* p) {
   return count;
 }
 
-// saves ustack bottom of current thread in p->freeustack
-void freeustack(struct proc* p, int thidx) {
-  p->freedustack[thidx] = p->thread[thidx].ustack;
-  p->thread[thidx].ustack = 0;
+// allocates a thread in p with a kernel stack set up to start
+// executing at forkret, and returns it in EMBRYO state
+// ptable.lock must be held
+struct thread* allocthread(struct proc* p) {
+  struct thread* th;
+  char* sp;
+  int thidx;
+
+  if ((thidx = allocth(p)) == -1)
+    return 0;
+  th = p->thread + thidx;
+  th->proc = p;
+  th->chargeto = 0;
+
+  // Allocate kernel stack, a page of p.
+  if((th->kstack = kallocfor(p)) == 0){
+    th->state = UNUSED;
+    return 0;
+  }
+  sp = th->kstack + KSTACKSIZE;
+
+  // Leave room for trap frame.
+  sp -= sizeof *th->tf;
+  th->tf = (struct trapframe*)sp;
+
+  // Set up new context to start executing at forkret,
+  // which returns to trapret.
+  sp -= 4;
+  *(uint*)sp = (uint)trapret;
+
+  sp -= sizeof *th->context;
+  th->context = (struct context*)sp;
+  memset(th->context, 0, sizeof *th->context);
+  th->context->eip = (uint)forkret;
+
+  return th;
+}
+
+// frees the kernel state of a thread that is not running and takes
+// it off the run or wait queue it is in
+// ptable.lock must be held
+static void freeth(struct thread* th) {
+  if (th->state == RUNNABLE)
+    eraserunq(th);
+  else if (th->state == SLEEPING)
+    erasesleep(th);
+  th->tid = 0;
+  if (th->kstack)
+    kfree(th->kstack);
+  th->kstack = 0;
+  th->state = UNUSED;
+  th->tf = 0;
+  th->context = 0;
+  th->chan = 0;
+}
+
+// makes the other threads of the process of cur leave the cpus and
+// waits until they are all ZOMBIE, so that cur has the process alone
+// ptable.lock must be held
+static void stopsiblings(struct thread* cur) {
+  struct proc* p = cur->proc;
+  struct thread* th;
+  int running;
+
+  p->exiter = cur;
+  for (;;) {
+    running = 0;
+    for (th = p->thread; th < &p->thread[NTHREAD]; th++) {
+      if (th == cur || th->state == UNUSED || th->state == ZOMBIE)
+        continue;
+      running = 1;
+      // it sees killed() and exits once it runs
+      if (th->state == SLEEPING) {
+        erasesleep(th);
+        makerunnable(th);
+      }
+    }
+    if (!running)
+      break;
+    // (See wakeup1 calls in exit and thread_exit.)
+    sleep(cur, &ptable.lock);
+  }
+}
+
+// frees all threads of the process of cur except cur itself
+void clearthreads(struct thread* cur) {
+  struct proc* p = cur->proc;
+  struct thread* th;
+
+  acquire(&ptable.lock);
+  if (p->exiter && p->exiter != cur) {
+    // the process is exiting or exec'ing in another thread
+    release(&ptable.lock);
+    exit();
+  }
+  stopsiblings(cur);
+  p->exiter = 0;
+  for (th = p->thread; th < &p->thread[NTHREAD]; th++) {
+    if (th == cur)
+      continue;
+    if (th->state != UNUSED)
+      freeth(th);
+    th->retval = 0;
+    th->ustack = 0;
+  }
+  release(&ptable.lock);
+}
+
+// A user stack is stacksize pages under its ustack bottom, above one
+// guard page. Free stacks keep their address range, unmapped and
+// guarded, in p->ustackpool for the next thread of any index.
+
+// returns the ustack bottom of a stack for a new thread of p, from the
+// pool or at the end of the process, or 0 on failure
+// only its top page is mapped if LAZYSTACK, the others on first touch
+// the memory lock and ptable.lock must be held
+static uint getustack(struct proc* p) {
+  uint base, top, stack = p->stacksize * PGSIZE;
+
+  while (p->nustackpool > 0) {
+    top = p->ustackpool[--p->nustackpool];
+    // sbrk may have shrunk the process below it
+    if (top <= p->sz)
+      goto found;
+  }
+  base = PGROUNDUP(p->sz);
+  top = base + PGSIZE + stack;
+  if (top >= KERNBASE || guarduvm(p->pgdir, base, top) < 0)
+    return 0;
+  p->sz = top;
+
+found:
+  unguarduvm(p->pgdir, top - stack, top);
+  if (allocuvm(p->pgdir, LAZYSTACK ? top - PGSIZE : top - stack, top) == 0) {
+    guarduvm(p->pgdir, top - stack, top);
+    p->ustackpool[p->nustackpool++] = top;
+    return 0;
+  }
+  return top;
+}
+
+// frees the pages of the stack with ustack bottom top and puts it in
+// the pool of p
+// flushes the tlbs of the other threads if shootdown is set
+// the memory lock must be held, and ptable.lock must not be: it is held
+// from unmapping to guarding, so a sibling thread touching the stack
+// meanwhile cannot fault a page of it in and keep it in its tlb
+static void putustack(struct proc* p, uint top, int shootdown) {
+  uint base = top - p->stacksize * PGSIZE;
+
+  acquire(&ptable.lock);
+  unmapuvm(p->pgdir, top, base);
+  if (shootdown)
+    tlbshootdown(p);
+  deallocuvm(p->pgdir, top, base);
+  // the page tables are there, this does not fail
+  guarduvm(p->pgdir, base, top);
+  release(&ptable.lock);
+  if (p->nustackpool < NTHREAD)
+    p->ustackpool[p->nustackpool++] = top;
 }
 
 // creates thread
 int thread_create(thread_t* thread, void*(*start_routine)(void*), void* arg) {
-  char* sp, *pustack;
-  struct proc *curproc = myproc();
-  int thidx;         // new thread index
+  char* sp;
+  struct thread *curth = mythread();
+  struct proc *curproc = curth->proc;
   struct thread* nt; // new thread pointer
-  uint sz, ustack[3+MAXARG+1];
+  uint top, ustack[3+MAXARG+1];
 
 // allocproc
+  // sibling threads may grow the process at the same time
+  lockmem(curproc);
   acquire(&ptable.lock);
 
   // Allocate thread.
-  if ((thidx = allocth(curproc)) == -1) {
-    return -1;
-  }
-  nt = curproc->thread + thidx;
-
-  // Allocate kernel stack.
-  if((nt->kstack = kalloc()) == 0){
-    nt->state = UNUSED;
+  if ((nt = allocthread(curproc)) == 0) {
+    release(&ptable.lock);
+    unlockmem(curproc);
     return -1;
   }
-  sp = nt->kstack + KSTACKSIZE;
-
-  // Leave room for trap frame.
-  sp -= sizeof *nt->tf;
-  nt->tf = (struct trapframe*)sp;
-  *nt->tf = *curproc->tf;
+  *nt->tf = *curth->tf;
 
   // Clear %eax so that fork returns 0 in the child.
   nt->tf->eax = 0; // not necessary
 
-  // Set up new context to start executing at forkret,
-  // which returns to trapret.
-  sp -= 4;
-  *(uint*)sp = (uint)trapret;
-
-  sp -= sizeof *nt->context;
-  nt->context = (struct context*)sp;
-  memset(nt->context, 0, sizeof *nt->context);
-  nt->context->eip = (uint)forkret;
-
 // exec
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
-  sz = PGROUNDUP(curproc->sz);
-
-  // reallocate freed ustack bottom
-  if (curproc->freedustack[thidx]) {
-    sp = curproc->freedustack[thidx];
-    curproc->freedustack[thidx] = 0;
-    pustack = sp;
-  }
-  // first use of this index
-  // allocate new user stack pages
-  else {
-    if((sz = allocuvm(curproc->pgdir, sz, sz + (1 + curproc->stacksize) * PGSIZE)) == 0)
-      goto bad;
-    clearpteu(curproc->pgdir, (char*)(sz - (1 + curproc->stacksize) * PGSIZE));
-    sp = (char*)sz;
-    pustack = (char*)sz;
-  }
+  // Take a free stack or make a new one with a guard page beneath.
+  if ((top = getustack(curproc)) == 0)
+    goto bad;
+  sp = (char*)top;
 
   ustack[0] = 0xffffffff;  // fake return PC
   ustack[1] = (uint)arg;
@@ -800,25 +1228,26 @@ int thread_create(thread_t* thread, void*(*start_routine)(void*), void* arg) {
   if(copyout(curproc->pgdir, (uint)sp, ustack, 2*4) < 0)
     goto bad;
 
-  curproc->sz = sz;
-  nt->ustack = pustack;
-  switchuvm(curproc); // not necessary
+  nt->ustack = (char*)top;
+  switchuvm(curth); // not necessary
   nt->tf->eip = (uint)start_routine;
   nt->tf->esp = (uint)sp;
-  nt->state = RUNNABLE;
+  makerunnable(nt);
   release(&ptable.lock);
+  unlockmem(curproc);
   *thread = nt->tid;
   return 0;
 
  bad:
-  if(curproc->pgdir)
-    freevm(curproc->pgdir);
+  freeth(nt);
+  release(&ptable.lock);
+  unlockmem(curproc);
   return -1;
 }
 
 void thread_exit(void* retval) {
-  struct proc *curproc = myproc();
-  struct thread* curth = curproc->thread + curproc->thidx;
+  struct thread* curth = mythread();
+  struct proc *curproc = curth->proc;
   acquire(&ptable.lock);
 
   curth->state = ZOMBIE;
@@ -827,16 +1256,15 @@ void thread_exit(void* retval) {
   if (countth(curproc) == 0) {
     cprintf("[WARN] trying to thread_exit the only thread -> Process killed\n");
     curproc->killed = 1;
-    curproc->state = RUNNABLE;
-    curth->state = RUNNABLE;
+    makerunnable(curth);
   }
 
   curth->retval = retval;
-  curproc->retval = retval;
   wakeup1(curth);
+  if (curproc->exiter)
+    wakeup1(curproc->exiter);
 
   // Jump into the scheduler, never to return
-  curproc->state = RUNNABLE;
   sched();
   if (curth->state == ZOMBIE) panic("zombie exit");
 }
@@ -845,6 +1273,8 @@ int thread_join(thread_t thread, void** retval) {
   struct thread* th;
   struct proc *curproc = myproc();
   int thidx = -1;
+  uint top;
+  void* ret;
 
   acquire(&ptable.lock);
   for (int i = 0; i < NTHREAD; ++i) {
@@ -860,22 +1290,24 @@ int thread_join(thread_t thread, void** retval) {
   }
   for (;;) {
     if (th->state == ZOMBIE) {
-      th->tid = 0;
-      if (th->kstack)
-        kfree(th->kstack);
-      th->kstack = 0;
-      th->state = UNUSED;
-      th->tf = 0;
-      th->context = 0;
-      th->chan = 0;
-      freeustack(curproc, thidx);
-
-      *retval = th->retval;
+      freeth(th);
+      top = (uint)th->ustack;
+      th->ustack = 0;
+      ret = th->retval;
       th->retval = 0;
       release(&ptable.lock);
+
+      // unmap its stack, sibling threads may have touched it
+      if (top) {
+        lockmem(curproc);
+        putustack(curproc, top, 1);
+        unlockmem(curproc);
+      }
+      // may fault in a page, so not under ptable.lock
+      *retval = ret;
       return 0;
     }
-    if (curproc->killed) {
+    if (killed()) {
       goto bad;
     }
     // Wait for thread to exit.  (See wakeup1 call in thread_exit.)
@@ -884,8 +1316,47 @@ int thread_join(thread_t thread, void** retval) {
 
 bad: 
   // No point waiting if we don't have any thread with tid.
-  if (thidx == -1 || curproc->killed) {
+  if (thidx == -1 || killed()) {
     release(&ptable.lock);
   }
   return -1;
 }
+
+// whether addr is a word of the current process that threads can wait
+// on. Threads sleep on the user address itself: the page under it
+// changes when a write copies a page shared by fork, and no kernel
+// chan is below KERNBASE. wakeupn only wakes threads of the process.
+static int futexaddr(int* addr) {
+  struct proc *curproc = myproc();
+
+  return (uint)addr % 4 == 0 && (uint)addr < curproc->sz && (uint)addr + 4 <= curproc->sz;
+}
+
+// sleeps until futex_wake on addr if *addr is still val
+// returns 0 when woken up, -1 if *addr was not val or on error
+int futex_wait(int* addr, int val) {
+  if (!futexaddr(addr) || touchmem((uint)addr, 4) < 0)
+    return -1;
+  acquire(&futexlock);
+  // may still fault if a sibling thread forked meanwhile, which does
+  // not take futexlock
+  if (*addr != val || killed()) {
+    release(&futexlock);
+    return -1;
+  }
+  sleep(addr, &futexlock);
+  release(&futexlock);
+  return 0;
+}
+
+// wakes up at most n threads waiting on addr and returns how many
+int futex_wake(int* addr, int n) {
+  int woken;
+
+  if (!futexaddr(addr))
+    return -1;
+  acquire(&futexlock);
+  woken = wakeupn(addr, myproc(), n);
+  release(&futexlock);
+  return woken;
+}
@@ -7,7 +7,9 @@ struct cpu {
   volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
-  struct proc *proc;           // The process running on this cpu or null
+  struct thread *thread;       // The thread running on this cpu or null
+  volatile uint tlbreq;        // tlb flushes asked by other cpus
+  volatile uint tlbdone;       // tlbreq when the tlb was flushed last
 };
 
 extern struct cpu cpus[NCPU];
@@ -36,19 +38,28 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 struct thread {
   thread_t tid;                // thread id
-  char *kstack;                // Bottom of kernel stack for this process -> each thread
-  enum procstate state;        // Thread state                      -> each thread
-  struct trapframe *tf;        // Trap frame for current syscall    -> each thread
-  struct context *context;     // swtch() here to run process       -> each thread
-  void *chan;                  // If non-zero, sleeping on chan     -> each thread
+  struct proc *proc;           // Process the thread belongs to
+  char *kstack;                // Bottom of kernel stack for this thread
+  enum procstate state;        // Thread state
+  struct trapframe *tf;        // Trap frame for current syscall
+  struct context *context;     // swtch() here to run thread
+  void *chan;                  // If non-zero, sleeping on chan
   void* retval;                // thread return value
   char* ustack;                // ustack bottom
+  struct thread *sleepprev;    // wait queue of chan
+  struct thread *sleepnext;
+  struct thread *runprev;      // run queue, only RUNNABLE threads
+  struct thread *runnext;
+  struct cpu *lastcpu;         // cpu it ran on last
+  uint lastrun;                // ticks when it stopped running
+  struct proc *chargeto;       // kalloc charges pages to it, see kchargeto
 };
 
-// Per-process state
+// Per-process state, shared by its threads
 struct proc {
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
+  enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
   int killed;                  // If non-zero, have been killed
@@ -57,18 +68,13 @@ struct proc {
   char name[16];               // Process name (debugging)
   uint stacksize;              // stack size (pages)
   uint limit;                  // memory limit (bytes)
-  char* freedustack[NTHREAD];  // freed ustack top for each thread index
+  int bigpages;                // heap grows by 4 MiB pages where aligned
+  uint ustackpool[NTHREAD];    // ustack bottoms of unmapped free stacks
+  int nustackpool;
+  int memlock;                 // a thread is changing sz and pgdir
+  struct thread *exiter;       // thread in exit() or exec(), others stop
 
   struct thread thread[NTHREAD]; // thread array
-  int thidx;                   // index of thread that ran recently
-
-  char *kstack;                // Bottom of kernel stack for this process -> each thread
-  enum procstate state;        // Process state                     -> each thread
-  struct trapframe *tf;        // Trap frame for current syscall    -> each thread
-  struct context *context;     // swtch() here to run process       -> each thread
-  void *chan;                  // If non-zero, sleeping on chan     -> each thread
-  void* retval;                // thread return value
-  char* ustack;                // ustack bottom
 };
 
 // Process memory is laid out contiguously, low addresses first:
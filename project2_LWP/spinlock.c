@@ -24,15 +24,21 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  struct cpu *c;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk)) {
     cprintf("[WARN] trying to acquire %s already held\n", lk->name);
     panic("acquire");
   }
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // The xchg is atomic. The holder may be waiting in tlbshootdown()
+  // for this cpu to flush, which it cannot do by interrupt here.
+  while(xchg(&lk->locked, 1) != 0){
+    c = mycpu();
+    if(c->tlbreq != c->tlbdone)
+      tlbflushintr();
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
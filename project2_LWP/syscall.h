@@ -25,4 +25,9 @@
 #define SYS_printProcList 24
 #define SYS_thread_create 25
 #define SYS_thread_exit 26
-#define SYS_thread_join 27
\ No newline at end of file
+#define SYS_thread_join 27
+#define SYS_futex_wait 28
+#define SYS_futex_wake 29
+#define SYS_spawn 30
+#define SYS_meminfo 31
+#define SYS_bigpages 32
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "meminfo.h"
 
 int
 sys_fork(void)
@@ -50,12 +51,29 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
+  // sibling threads may grow the process at the same time
+  lockmem(myproc());
   addr = myproc()->sz;
   if(growproc(n) < 0)
-    return -1;
+    addr = -1;
+  unlockmem(myproc());
   return addr;
 }
 
+// bigpages(1) makes later sbrk() growth map each aligned 4 MiB block
+// it covers with one large page; the setting is kept across exec and
+// inherited by children
+int
+sys_bigpages(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  myproc()->bigpages = on != 0;
+  return 0;
+}
+
 int
 sys_sleep(void)
 {
@@ -67,7 +85,7 @@ sys_sleep(void)
   acquire(&tickslock);
   ticks0 = ticks;
   while(ticks - ticks0 < n){
-    if(myproc()->killed){
+    if(killed()){
       release(&tickslock);
       return -1;
     }
@@ -104,12 +122,24 @@ int sys_printProcList(void) {
   return printProcList();
 }
 
+int sys_meminfo(void) {
+  int pid;
+  struct meminfo* umi;
+  struct meminfo mi;
+  if (argint(0, &pid) < 0 || argptr(1, (char**)&umi, sizeof(*umi)) < 0) return -1;
+  if (meminfo(pid, &mi) < 0) return -1;
+  // not under ptable.lock, the write may fault
+  *umi = mi;
+  return 0;
+}
+
 int sys_thread_create(void) {
-  int thread, start_routine, arg;
-  if (argint(0, &thread) < 0 || argint(1, &start_routine) < 0 || argint(2, &arg) < 0) {
+  thread_t *thread;
+  int start_routine, arg;
+  if (argptr(0, (char**)&thread, sizeof(*thread)) < 0 || argint(1, &start_routine) < 0 || argint(2, &arg) < 0) {
     return -1;
   } 
-  return thread_create((thread_t*)thread, (void*)start_routine, (void*)arg);
+  return thread_create(thread, (void*)start_routine, (void*)arg);
 }
 
 int sys_thread_exit(void) {
@@ -120,7 +150,20 @@ int sys_thread_exit(void) {
 }
 
 int sys_thread_join(void) {
-  int thread, retval;
-  if (argint(0, &thread) < 0 || argint(1, &retval)) return -1;
-  return thread_join(thread, (void**) retval);
-}
\ No newline at end of file
+  int thread;
+  void **retval;
+  if (argint(0, &thread) < 0 || argptr(1, (char**)&retval, sizeof(*retval)) < 0) return -1;
+  return thread_join(thread, retval);
+}
+
+int sys_futex_wait(void) {
+  int addr, val;
+  if (argint(0, &addr) < 0 || argint(1, &val) < 0) return -1;
+  return futex_wait((int*)addr, val);
+}
+
+int sys_futex_wake(void) {
+  int addr, n;
+  if (argint(0, &addr) < 0 || argint(1, &n) < 0) return -1;
+  return futex_wake((int*)addr, n);
+}
@@ -34,5 +34,6 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_TLBFLUSH    24      // IPI to flush the tlb of a shared page table
 #define IRQ_SPURIOUS    31
 
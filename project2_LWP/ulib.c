@@ -104,3 +104,124 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+static inline int
+cas(volatile int *addr, int expected, int newval)
+{
+  int result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (expected) :
+               "cc", "memory");
+  return result;
+}
+
+void
+mutex_init(mutex_t *m)
+{
+  m->state = 0;
+}
+
+// Takes the lock with one cmpxchg if nobody holds it. Otherwise marks
+// it contended and sleeps in the kernel until the holder wakes us.
+void
+mutex_lock(mutex_t *m)
+{
+  int c;
+
+  if((c = cas(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = xchg((volatile uint*)&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = xchg((volatile uint*)&m->state, 2);
+  }
+}
+
+int
+mutex_trylock(mutex_t *m)
+{
+  return cas(&m->state, 0, 1) == 0;
+}
+
+// Only enters the kernel if another thread waits for the lock.
+void
+mutex_unlock(mutex_t *m)
+{
+  if(xchg((volatile uint*)&m->state, 0) == 2)
+    futex_wake(&m->state, 1);
+}
+
+void
+cond_init(cond_t *cv)
+{
+  cv->seq = 0;
+  cv->waiters = 0;
+}
+
+// m must be held. A signal between the unlock and the futex_wait
+// changes seq, so futex_wait returns at once and it is not lost.
+void
+cond_wait(cond_t *cv, mutex_t *m)
+{
+  int seq = cv->seq;
+
+  cv->waiters++;
+  mutex_unlock(m);
+  futex_wait(&cv->seq, seq);
+  mutex_lock(m);
+  cv->waiters--;
+}
+
+// The mutex of cv must be held, so that waiters is exact and a signal
+// with nobody waiting stays in user space.
+void
+cond_signal(cond_t *cv)
+{
+  if(cv->waiters == 0)
+    return;
+  __sync_fetch_and_add(&cv->seq, 1);
+  futex_wake(&cv->seq, 1);
+}
+
+void
+cond_broadcast(cond_t *cv)
+{
+  if(cv->waiters == 0)
+    return;
+  __sync_fetch_and_add(&cv->seq, 1);
+  futex_wake(&cv->seq, cv->waiters);
+}
+
+void
+barrier_init(barrier_t *b, int n)
+{
+  mutex_init(&b->lock);
+  cond_init(&b->cv);
+  b->n = n;
+  b->count = 0;
+  b->phase = 0;
+}
+
+// Returns 1 in the last thread to arrive, 0 in the others.
+int
+barrier_wait(barrier_t *b)
+{
+  int phase;
+
+  mutex_lock(&b->lock);
+  phase = b->phase;
+  if(++b->count == b->n){
+    b->count = 0;
+    b->phase++;
+    cond_broadcast(&b->cv);
+    mutex_unlock(&b->lock);
+    return 1;
+  }
+  while(phase == b->phase)
+    cond_wait(&b->cv, &b->lock);
+  mutex_unlock(&b->lock);
+  return 0;
+}
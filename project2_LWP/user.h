@@ -1,5 +1,24 @@
 struct stat;
 struct rtcdate;
+struct meminfo;
+
+// ulib.c: locks for threads, futex_wait only when contended
+typedef struct {
+  volatile int state;   // 0 unlocked, 1 locked, 2 locked with waiters
+} mutex_t;
+
+typedef struct {
+  volatile int seq;     // bumped by every signal
+  int waiters;          // threads in cond_wait, under the mutex
+} cond_t;
+
+typedef struct {
+  mutex_t lock;
+  cond_t cv;
+  int n;                // threads to wait for
+  int count;            // threads arrived in this phase
+  int phase;
+} barrier_t;
 
 // system calls
 int fork(void);
@@ -11,6 +30,7 @@ int read(int, void*, int);
 int close(int);
 int kill(int);
 int exec(char*, char**);
+int spawn(char*, char**, int*);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -21,14 +41,18 @@ int chdir(const char*);
 int dup(int);
 int getpid(void);
 char* sbrk(int);
+int bigpages(int);
 int sleep(int);
 int uptime(void);
 int exec2(char*, char**, int);
 int setmemorylimit(int, int);
 int printProcList(void);
+int meminfo(int, struct meminfo*);
 int thread_create(thread_t*, void*(void*), void*);
 int thread_exit(void*);
 int thread_join(thread_t, void**);
+int futex_wait(volatile int*, int);
+int futex_wake(volatile int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -43,3 +67,13 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+int mutex_trylock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
+void barrier_init(barrier_t*, int);
+int barrier_wait(barrier_t*);
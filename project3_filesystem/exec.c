@@ -7,8 +7,12 @@
 #include "x86.h"
 #include "elf.h"
 
+// Load the program at path with arguments argv into a new page
+// table for p. Once nothing can fail any more, p is switched over
+// to it and its trapframe set to start the program; the old page
+// table of p is left to the caller. Returns -1 if p is unchanged.
 int
-exec(char *path, char **argv)
+loadimage(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -16,8 +20,7 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  pde_t *pgdir;
 
   begin_op();
 
@@ -91,16 +94,13 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  p->pgdir = pgdir;
+  p->sz = sz;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
   return 0;
 
  bad:
@@ -112,3 +112,16 @@ exec(char *path, char **argv)
   }
   return -1;
 }
+
+int
+exec(char *path, char **argv)
+{
+  struct proc *curproc = myproc();
+  pde_t *oldpgdir = curproc->pgdir;
+
+  if(loadimage(curproc, path, argv) < 0)
+    return -1;
+  switchuvm(curproc);
+  freevm(oldpgdir);
+  return 0;
+}
@@ -12,3 +12,5 @@
 #define NRESBUF     2  // reserved size of disk block cache
 #define LOGSIZE  (MAXOPBLOCKS*5 + NRESBUF)  // max data blocks in on-disk log
 #define FSSIZE  1000000  // size of file system in blocks
+#define KMAXORDER    10  // largest kalloc_order() block is 2^KMAXORDER pages
+#define NSLEEPQ      64  // wait queues of sleep/wakeup, power of 2
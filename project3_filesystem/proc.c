@@ -10,6 +10,7 @@
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct proc *sleepq[NSLEEPQ];   // sleeping processes hashed by chan
 } ptable;
 
 static struct proc *initproc;
@@ -88,6 +89,7 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->bigpages = 0;
 
   release(&ptable.lock);
 
@@ -163,8 +165,12 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // the pages are mapped on first touch, see trap()
+    if(sz + n >= KERNBASE)
       return -1;
+    if(curproc->bigpages)
+      allocbiguvm(curproc->pgdir, sz, sz + n);
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -196,6 +202,8 @@ fork(void)
     np->state = UNUSED;
     return -1;
   }
+  // the pages of the parent went read-only
+  lcr3(V2P(curproc->pgdir));
   np->sz = curproc->sz;
   np->parent = curproc;
   *np->tf = *curproc->tf;
@@ -207,6 +215,7 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  np->bigpages = curproc->bigpages;
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -221,6 +230,58 @@ fork(void)
   return pid;
 }
 
+// Create a process running the program at path with arguments argv,
+// without copying the caller first as fork() and exec() would. File
+// descriptor i of the new process is a dup of the caller's fdmap[i],
+// or closed if that is -1; with no fdmap it gets all of the caller's
+// descriptors, as in fork(). fdmap is kernel memory holding only -1 or
+// descriptor numbers. Returns the pid of the new process.
+int
+spawn(char *path, char **argv, int *fdmap)
+{
+  int i, fd, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if(fdmap)
+    for(i = 0; i < NOFILE; i++)
+      if(fdmap[i] != -1 && curproc->ofile[fdmap[i]] == 0)
+        return -1;
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // The segments and flags of a user trapframe; loadimage sets the rest.
+  *np->tf = *curproc->tf;
+  if(loadimage(np, path, argv) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->parent = curproc;
+
+  for(i = 0; i < NOFILE; i++){
+    fd = fdmap ? fdmap[i] : i;
+    if(fd >= 0 && curproc->ofile[fd])
+      np->ofile[i] = filedup(curproc->ofile[fd]);
+  }
+  np->cwd = idup(curproc->cwd);
+  np->bigpages = curproc->bigpages;
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->state = RUNNABLE;
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -412,6 +473,42 @@ forkret(void)
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// Wait queue of the sleepers on chan, shared by the channels with the
+// same hash.
+static struct proc**
+sleepqueue(void *chan)
+{
+  uint h = (uint)chan >> 2;
+
+  return &ptable.sleepq[(h ^ (h >> 7) ^ (h >> 14)) & (NSLEEPQ - 1)];
+}
+
+// The ptable lock must be held.
+static void
+pushsleep(struct proc *p)
+{
+  struct proc **q = sleepqueue(p->chan);
+
+  p->sleepprev = 0;
+  p->sleepnext = *q;
+  if(*q)
+    (*q)->sleepprev = p;
+  *q = p;
+}
+
+// The ptable lock must be held.
+static void
+erasesleep(struct proc *p)
+{
+  if(p->sleepprev)
+    p->sleepprev->sleepnext = p->sleepnext;
+  else
+    *sleepqueue(p->chan) = p->sleepnext;
+  if(p->sleepnext)
+    p->sleepnext->sleepprev = p->sleepprev;
+  p->sleepprev = p->sleepnext = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -431,12 +528,15 @@ sleep(void *chan, struct spinlock *lk)
   // guaranteed that we won't miss any wakeup
   // (wakeup runs with ptable.lock locked),
   // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
+  if(lk != &ptable.lock)  //DOC: sleeplock0
     acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
   // Go to sleep.
+  // Queued before lk is released, so a wakeup(chan) called with lk
+  // held either finds this process or comes before the sleep.
   p->chan = chan;
+  pushsleep(p);
+  if(lk != &ptable.lock)
+    release(lk);
   p->state = SLEEPING;
 
   sched();
@@ -454,20 +554,30 @@ sleep(void *chan, struct spinlock *lk)
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
+// Only walks the wait queue of chan.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *next;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
+  for(p = *sleepqueue(chan); p; p = next){
+    next = p->sleepnext;
+    if(p->chan == chan){
+      erasesleep(p);
       p->state = RUNNABLE;
+    }
+  }
 }
 
 // Wake up all processes sleeping on chan.
+// Every caller holds the lock the sleepers passed to sleep(), and a
+// sleeper is queued before it releases that lock, so an empty wait
+// queue means there is no one to wake and ptable.lock is not taken.
 void
 wakeup(void *chan)
 {
+  if(*sleepqueue(chan) == 0)
+    return;
   acquire(&ptable.lock);
   wakeup1(chan);
   release(&ptable.lock);
@@ -486,8 +596,10 @@ kill(int pid)
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
+      if(p->state == SLEEPING){
+        erasesleep(p);
         p->state = RUNNABLE;
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -531,6 +643,7 @@ procdump(void)
     }
     cprintf("\n");
   }
+  kallocdump();
 }
 
 int getpid() {
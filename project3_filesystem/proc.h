@@ -45,10 +45,13 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *sleepprev;      // wait queue of chan
+  struct proc *sleepnext;
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int bigpages;                // heap grows by 4 MiB pages where aligned
 };
 
 // Process memory is laid out contiguously, low addresses first:
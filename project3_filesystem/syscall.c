@@ -21,6 +21,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(touchuvm(curproc->pgdir, addr, 4) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +41,9 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       touchuvm(curproc->pgdir, (uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -65,6 +70,8 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(touchuvm(curproc->pgdir, i, size) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -105,6 +112,8 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_symlink(void);
 extern int sys_sync(void);
+extern int sys_spawn(void);
+extern int sys_bigpages(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -130,6 +139,8 @@ static int (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_symlink] sys_symlink,
 [SYS_sync]    sys_sync,
+[SYS_spawn]   sys_spawn,
+[SYS_bigpages] sys_bigpages,
 };
 
 void
@@ -21,4 +21,6 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_symlink 22
-#define SYS_sync   23
\ No newline at end of file
+#define SYS_sync   23
+#define SYS_spawn  24
+#define SYS_bigpages 25
@@ -56,6 +56,20 @@ sys_sbrk(void)
   return addr;
 }
 
+// bigpages(1) makes later sbrk() growth map each aligned 4 MiB block
+// it covers with one large page; the setting is kept across exec and
+// inherited by children
+int
+sys_bigpages(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  myproc()->bigpages = on != 0;
+  return 0;
+}
+
 int
 sys_sleep(void)
 {
@@ -78,6 +78,15 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // heap pages are mapped on first touch (see growproc) and pages
+    // shared by fork copied on the first write. system calls fault in
+    // their user buffers with touchuvm() before using them, so a bad
+    // buffer or no memory fails the call rather than getting here
+    if(myproc() && rcr2() < myproc()->sz &&
+       faultuvm(myproc()->pgdir, rcr2()) >= 0)
+      break;
+    // fall through
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
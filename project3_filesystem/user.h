@@ -11,6 +11,7 @@ int read(int, void*, int);
 int close(int);
 int kill(int);
 int exec(char*, char**);
+int spawn(char*, char**, int*);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -21,6 +22,7 @@ int chdir(const char*);
 int dup(int);
 int getpid(void);
 char* sbrk(int);
+int bigpages(int);
 int sleep(int);
 int uptime(void);
 int symlink(const char*, const char*);
@@ -130,6 +130,12 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+static inline void
+invlpg(void *addr)
+{
+  asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
 static inline uint
 rcr2(void)
 {